@@ -0,0 +1,115 @@
+#ifndef ASYNCDETECTOR_H
+#define ASYNCDETECTOR_H
+
+#include "yoloInterface.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+
+//bounded single producer/single consumer ring - lock free
+template <typename T, unsigned int CAPACITY>
+class SPSCQueue {
+public:
+
+    bool push(const T &val) {
+        const unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        const unsigned int next = (tail + 1) % (CAPACITY + 1);
+        if (next == m_head.load(std::memory_order_acquire))
+            return false; //full
+        m_buf[tail] = val;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &val) {
+        const unsigned int head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false; //empty
+        val = m_buf[head];
+        m_head.store((head + 1) % (CAPACITY + 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, CAPACITY + 1> m_buf;
+    std::atomic<unsigned int> m_head{0};
+    std::atomic<unsigned int> m_tail{0};
+};
+
+//runs preprocess (letterbox), forward & postprocess (boxes + nms) of YoloInterface on separate threads so consecutive frames overlap
+//only newest submitted frame waits for pipeline - older waiting frames are dropped. all state is per instance
+class AsyncDetector {
+public:
+
+    struct Result {
+        unsigned long frame_id;
+        bool dropped; //replaced by newer frame before it entered pipeline or detector shut down - no predictions
+        std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > predictions;
+    };
+    typedef std::function<void(const Result&)> Callback;
+
+    //yolo must stay alive & must not be used by caller until this is destroyed
+    AsyncDetector(YoloInterface &yolo);
+    ~AsyncDetector(void);
+
+    AsyncDetector(const AsyncDetector&) = delete;
+    AsyncDetector& operator=(const AsyncDetector&) = delete;
+
+    //never blocks. frame is not copied - do not write to it after submitting. callback (if any) runs on postprocess thread, or on submitting thread if frame gets dropped
+    std::future<Result> submit(const cv::Mat &frame, Callback callback = nullptr);
+
+    unsigned long getFramesSubmitted(void) const;
+    unsigned long getFramesDropped(void) const;
+    unsigned long getFramesCompleted(void) const;
+
+private:
+    static constexpr unsigned int NUM_SLOTS = 3; //frames in flight - one per stage
+
+    struct Job {
+        unsigned long frame_id;
+        cv::Mat frame;
+        std::promise<Result> promise;
+        Callback callback;
+    };
+
+    struct Slot {
+        std::vector<float> input;
+        std::vector<float> outputs; //saved detection layer outputs
+        std::unique_ptr<Job> job;
+    };
+
+    YoloInterface &m_yolo;
+    network m_net_view; //copy of network struct for postprocess thread - network_predict rewrites *m_net
+    NMSEngine m_nms; //postprocess thread only
+    std::vector<yolo_candidate> m_candidates; //postprocess thread only
+
+    std::array<Slot, NUM_SLOTS> m_slots;
+    std::atomic<Job*> m_pending; //latest-frame-wins mailbox
+    SPSCQueue<unsigned int, NUM_SLOTS> m_free; //postprocess -> preprocess
+    SPSCQueue<unsigned int, NUM_SLOTS> m_to_forward; //preprocess -> forward
+    SPSCQueue<unsigned int, NUM_SLOTS> m_to_postprocess; //forward -> postprocess
+
+    std::atomic<bool> m_running;
+    std::atomic<unsigned long> m_submitted;
+    std::atomic<unsigned long> m_dropped;
+    std::atomic<unsigned long> m_completed;
+
+    std::thread m_preprocess_thread;
+    std::thread m_forward_thread;
+    std::thread m_postprocess_thread;
+
+private:
+    //helper functions
+    void preprocessLoop(void);
+    void forwardLoop(void);
+    void postprocessLoop(void);
+    void finish(std::unique_ptr<Job> &job, Result &result);
+    void drop(std::unique_ptr<Job> &job);
+    static void backoff(unsigned int &spins);
+};
+
+#endif
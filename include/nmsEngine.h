@@ -0,0 +1,37 @@
+#ifndef NMSENGINE_H
+#define NMSENGINE_H
+
+#include "darknet.h"
+
+#include <vector>
+
+//greedy per-class nms with same result as do_nms_sort: candidates are bucketed by class first so empty classes cost nothing,
+//each bucket is sorted once & suppression runs over struct-of-arrays boxes (vectorizable). buffers are reused between calls
+class NMSEngine {
+public:
+    NMSEngine(void) = default;
+
+    //zeroes prob[k] of every box suppressed within class k (like do_nms_sort, but does not reorder dets)
+    void process(detection *dets, int total, int classes, float thresh);
+    //same for decode_yolo_candidates output - zeroes prob of suppressed candidates
+    void process(yolo_candidate *cands, int total, int classes, float thresh);
+
+    unsigned int getLastCandidates(void) const; //number of (box, class) pairs considered in last call
+
+private:
+    std::vector< std::vector<int> > m_buckets; //box indices with non zero prob per class
+
+    //boxes of current bucket in score order
+    std::vector<float> m_left, m_top, m_right, m_bottom, m_area;
+    std::vector<unsigned char> m_suppressed;
+
+    unsigned int m_last_candidates = 0;
+
+private:
+    //helper functions
+    void resetBuckets(int classes);
+    //sorts bucket by score & flags suppressed entries in m_suppressed (in sorted bucket order)
+    template <typename SCORE, typename BOX> void suppressBucket(std::vector<int> &bucket, SCORE score, BOX get_box, float thresh);
+};
+
+#endif
@@ -2,26 +2,39 @@
 #define SEGMENTATION_H
 
 #include <opencv2/opencv.hpp>
+#include <opencv2/ximgproc/segmentation.hpp>
 
 namespace Segmentation {
 
-    void process(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores);
+    void process(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, int resize_h = 200);
+
+    //segments at coarse_h, then re-segments neighbourhoods of best coarse proposals at fine_h (in parallel) and merges results
+    void processCoarseToFine(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, int coarse_h = 200, int fine_h = 800, unsigned int max_refinements = 8);
+
+    struct StreamState;
+    //for video - carries k values, label maps & proposals from previous frame and only re-segments changed tiles
+    void processStream(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, StreamState &state);
     cv::Mat showSegmentationResults(const cv::Mat &img, const std::vector<cv::Rect> &proposals, const std::vector<float> &scores, const std::string &window_name = "segmentation_results", unsigned int display_outline_thickness = 1, bool show_scores = true);
 
     struct RegionProposal;
 
     //6 Domains [BGR, HSV, LAB, I, RGI, YUV]
     void getDomains(const cv::Mat &img, std::vector<cv::Mat> &img_domains, int resize_h = 200);
+    void getDomainsFused(const cv::Mat &img, std::vector<cv::Mat> &img_domains, int resize_h = 200); //same output as getDomains - single tiled pass & reuses buffers in img_domains
     void getSegmentations(const std::vector<cv::Mat> &img_domains, std::vector< std::vector<cv::Mat> > &segmentations, unsigned int seg_levels = 5);
+    float segmentWithAutoK(cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> &gs, const cv::Mat &img_domain, cv::Mat &img_seg, float k); //returns k used
     void getBoundingBoxes(const cv::Mat &img_seg, std::vector<cv::Rect> &boxes, float max_region_size = 0.5);
 
     void generateRegionProposals(const std::vector< std::vector<cv::Mat> > &segmentations, std::vector<RegionProposal> &proposals, float max_region_size = 0.5);
+    void generateSegmentationProposals(const cv::Mat &img_seg, float score, int domain, int seg_level, std::vector<RegionProposal> &proposals, std::vector<int> &proposal_labels, const std::vector<bool> &consider_labels = std::vector<bool>(), float max_region_size = 0.5); //appends - only labels in consider_labels if not empty
+    void mergeRegionProposals(std::vector<RegionProposal> &img_proposals, std::vector<cv::Rect> &proposals, std::vector<float> &scores); //all merging steps of process
     void mergeProposalsWithinSegmentationLevel(std::vector<RegionProposal> &proposals, float IOU_thresh = 0.95, float IU_diff_percentage = 0.005);
     void mergeProposalsBetweenSegmentationLevels(std::vector<RegionProposal> &proposals, float min_score = 1.f, float IOU_thresh = 0.95, float IU_diff_percentage = 0.005);
     void mergeProposalsCommonThroughoutDomain(std::vector<RegionProposal> &proposals, float IOU_thresh = 0.95, float IU_diff_percentage = 0.0075, unsigned int num_segmentations_levels = 5);
     void getSignificantMergedRegions(const std::vector<RegionProposal> &proposals, std::vector<cv::Rect> &signficiant_regions, std::vector<float> &sigificant_region_scores);
     void resizeRegion(cv::Rect &region, int original_w, int original_h, int resize_w, int resize_h);
     void resizeRegions(std::vector<cv::Rect> &regions, int original_w, int original_h, int resize_w, int resize_h);
+    float getRecall(const std::vector<cv::Rect> &proposals, const std::vector<cv::Rect> &ground_truth, float IOU_thresh = 0.5); //fraction of ground truth boxes covered by a proposal
 
     struct RegionProposal {
 
@@ -75,8 +88,9 @@ namespace Segmentation {
             return os;
         }
 
-        static float total_merge_scores;
-        static int img_area;
+        //per thread so independent images can be processed in parallel
+        static thread_local float total_merge_scores;
+        static thread_local int img_area;
 
         static void removeInvalidProposals(std::vector<RegionProposal> &proposals) {
             proposals.erase(std::remove_if(proposals.begin(), proposals.end(), [](const RegionProposal & p)->bool {
@@ -89,6 +103,36 @@ namespace Segmentation {
         }
     };
 
+    struct StreamState {
+        StreamState(float change_threshold = 8.f, int grid = 8, int keyframe = 30, float max_changed = 0.5f);
+
+        void reset(void);
+
+        //ratio of reused to recomputed segmentation work (in pixels) for last frame
+        float getReuseRatio(void) const {
+            return pixels_reused / std::max(pixels_recomputed, 1.0);
+        }
+
+        float change_thresh; //mean absolute BGR difference above which a tile is considered changed
+        int grid_size; //tiles along each dimension
+        int keyframe_interval; //frames between full re-segmentations - also bounds growth of label ids from patching
+        float max_changed_fraction; //fraction of changed tiles (or of image area in patches) above which frame is segmented from scratch
+
+        int frame_count;
+        cv::Mat prev_bgr;
+        std::vector<cv::Mat> domains;
+        std::vector<float> k_values; //tuned k of first segmentation level per domain
+        std::vector< std::vector<cv::Mat> > segmentations; //[domain][level]
+        std::vector< std::vector< std::vector<RegionProposal> > > raw_proposals; //[domain][level] - before merging
+        std::vector< std::vector< std::vector<int> > > raw_proposal_labels; //segment label of each raw proposal
+
+        //statistics of last frame
+        int tiles_changed;
+        int tiles_total;
+        double pixels_reused;
+        double pixels_recomputed;
+    };
+
     //helper functions
 
     void mergeProposalsCommonInDomain(std::vector<RegionProposal>::iterator domain_start, std::vector<RegionProposal>::iterator domain_end, float IOU_thresh, float IU_diff_percentage, unsigned int num_segmentations_levels);
@@ -13,9 +13,8 @@
 namespace SegmentationCV {
 
 #ifdef DEBUG_SEGMENTATION
+    //copies of last process call for display only
     extern std::vector<cv::Mat> m_images;
-    extern std::vector<cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> > m_segmentations;
-    extern std::vector<cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategy> > m_strategies;
 
     extern std::vector<cv::Mat> debugDisp1, debugDisp2;
 #endif
@@ -71,6 +70,29 @@ namespace SegmentationCV {
         }
     };
 
+    // Features of one segmentation - computed once and shared by all strategies grouping it
+
+    struct SegmentationFeatures {
+        int img_size;
+        cv::Mat_<int32_t> sizes; // Pixels per region (nb_segs x 1)
+        std::vector<cv::Rect> bounding_rects;
+        cv::Mat_<float> color_hists; // Normalized histogram per region row
+        cv::Mat_<float> texture_hists;
+
+        // CSR adjacency - neighbors[neighbor_offsets[i]..neighbor_offsets[i+1]) are the neighbors of region i with larger index
+        std::vector<int> neighbor_offsets;
+        std::vector<int> neighbors;
+    };
+
+    // Weights of each similarity measure in a strategy
+
+    struct StrategyWeights {
+        float color;
+        float fill;
+        float texture;
+        float size;
+    };
+
     // Represent a neighbor
 
     class Neighbor {
@@ -2,6 +2,7 @@
 #define YOLOINTERFACE_H
 
 #include "darknet.h"
+#include "nmsEngine.h"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
@@ -10,8 +11,18 @@
 #include <vector>
 
 class YoloInterface {
+    friend class AsyncDetector; //drives network directly to pipeline frames
+
 public:
-    YoloInterface(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, float thresh = 0.5);
+
+    //compact result - class name via getClassName(class_id)
+    struct Detection {
+        cv::Rect box;
+        float score;
+        int class_id;
+    };
+
+    YoloInterface(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, float thresh = 0.5, bool half_weights = false, const std::string &conv_plan_file = "");
     YoloInterface(float thresh = 0.5);
     ~YoloInterface(void);
 
@@ -21,11 +32,49 @@ public:
     YoloInterface& operator=(const YoloInterface&) = delete;
     YoloInterface& operator=(YoloInterface&&) = default;
 
-    void loadNetwork(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file);
+    //half_weights stores convolution weights as fp16 (half the weight memory, expanded to fp32 as they are used)
+    //conv_plan_file: fastest algorithm of each convolution is read from it, or timed & saved to it if it was made for another cfg, input size or cpu
+    void loadNetwork(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, bool half_weights = false, const std::string &conv_plan_file = "");
 
     void setThresholds(float threshold = 0.5, float threshold_hier = 0.5);
+    //only these classes are decoded & reported (names not in label file are ignored). empty means all
+    void setClassWhitelist(const std::vector<std::string> &class_names);
 
     std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > processImage(const cv::Mat &img);
+    //no heap allocations once detections & internal box pool have grown to fit - reuse detections across frames. does not change stored results
+    void processImage(const cv::Mat &img, std::vector<Detection> &detections);
+    const std::string& getClassName(int class_id) const;
+    //one forward pass for all images (network batch is resized as needed) - predictions per image. does not change stored results
+    std::vector< std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > > processImages(const std::vector<cv::Mat> &imgs);
+
+    //times old (img_cv_to_yolo + letterbox_image) against fused preprocessing and prints time saved per frame
+    void comparePreprocessing(const cv::Mat &img, unsigned int iterations = 50);
+    //times do_nms_sort against NMSEngine at detection thresholds 0.5 & 0.001 on boxes of img and checks results match
+    void compareNMS(const cv::Mat &img, unsigned int iterations = 20);
+    //prints images/sec of processImages for batch sizes 1 to max_batch
+    void benchmarkBatchSizes(const cv::Mat &img, unsigned int max_batch = 16, unsigned int iterations = 5);
+    //prints GFLOP/s of old gemm against packed gemm (every simd kernel cpu supports) for each convolution shape of network
+    void compareGEMM(unsigned int iterations = 3);
+    //times im2col against winograd for each winograd convolution of network & checks outputs agree
+    void compareWinograd(unsigned int iterations = 3);
+    //times im2col against direct convolution for each direct layer of network & reports workspace each needs
+    void compareDirect(unsigned int iterations = 3);
+    //int8 inference: runs images of folder through fp32 network, records input range of every convolution, saves them to calibration_file & enables int8
+    void calibrateInt8(const std::string &image_folder, const std::string &calibration_file);
+    //quantizes network with ranges of calibration_file (from calibrateInt8) - false if file does not match network
+    bool enableInt8(const std::string &calibration_file);
+    //fp32 against int8 on images of folder (held-out, not used for calibration): detections matched by class & IoU, time per image
+    void compareInt8(const std::string &image_folder, float iou_thresh = 0.5);
+    //times fp32 against int8 for each quantized convolution of network & reports output error
+    void compareInt8Layers(unsigned int iterations = 3);
+    //times binarized float gemm against bit-packed xnor-popcount path for each xnor convolution of network & checks outputs agree
+    void compareXnor(unsigned int iterations = 3);
+    //opt-in per layer profile: from now on every forward pass adds time of each layer (false stops & drops it)
+    void enableProfiling(bool enable = true);
+    //table of ms, GFLOP/s & bytes per layer since enableProfiling. also saved to report_file if given (.json, else csv)
+    void printProfile(const std::string &report_file = "");
+    //profile of frames forward passes on img (after one warm up frame) - printProfile of them
+    void profileLayers(const cv::Mat &img, unsigned int frames = 20, const std::string &report_file = "");
 
     void saveResults(const std::string &filename) const;
     void readResults(const std::string &filename);
@@ -47,12 +96,28 @@ private:
     std::vector<std::string> m_class_names;
 
     std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > m_predictions;
+    std::vector<int> m_class_whitelist;
+
+    bool m_raw_decode; //yolo heads skip logistic in forward & are decoded with decode_yolo_candidates
+    std::vector<yolo_candidate> m_candidates;
+    std::vector<Detection> m_detections;
+    detection_pool m_pool; //box arena reused every frame
+    NMSEngine m_nms;
 
 private:
     //helper functions
     cv::Mat img_yolo_to_cv(const image &img);
     image img_cv_to_yolo(const cv::Mat &img);
-    void sortPredictionsByObjectness(void);
+    void getPredictions(int batch, int img_w, int img_h, std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > &predictions);
+    void getDetections(int batch, int img_w, int img_h, std::vector<Detection> &detections);
+    //decodes yolo layers of net (batch or, if given, outputs saved with save_detection_outputs) into candidates (grown as needed) - returns count
+    unsigned int decodeCandidates(const network &net, int batch, float *saved, int img_w, int img_h, std::vector<yolo_candidate> &candidates) const;
+    //nms, thresholding & sorting of candidates or darknet boxes. only reads own state, safe to call while network runs another frame (with a different nms)
+    void convertCandidates(yolo_candidate *cands, unsigned int count, int img_w, int img_h, std::vector<Detection> &detections, NMSEngine &nms) const;
+    void convertDetections(detection *dets, int nboxes, int img_w, int img_h, std::vector<Detection> &detections, NMSEngine &nms) const;
+    static cv::Rect toRect(const box &b, int img_w, int img_h);
+    static void sortDetections(std::vector<Detection> &detections);
+    void toPredictions(const std::vector<Detection> &detections, std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > &predictions) const;
 };
 
 #endif
\ No newline at end of file
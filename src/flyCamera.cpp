@@ -58,6 +58,7 @@ int main(int argc, char * argv[]) {
     //for performing segmentation
     std::vector<cv::Rect> segmentation_regions;
     std::vector<float> segmentation_scores;
+    Segmentation::StreamState segmentation_stream;
 
     //for performing yolo detection
     const std::string labelFile = "/home/dp/Desktop/darknet-master/data/coco.names";
@@ -72,12 +73,13 @@ int main(int argc, char * argv[]) {
     //for control of operations
     unsigned int key = '\0';
     bool run_segmentation = false;
+    bool stream_segmentation = false;
     bool run_yolo = false;
     bool pause_camera = false;
     bool capture_frame = false;
     bool save_captured = false;
     bool video_capture = false;
-    const std::vector<std::string> help_text = {"c: capture", "w: save captured", "p: pause", "r: reset everything", "s: segment captured", "y: run yolo on captured", "v: run video capture", "Q/ESC: exit"};
+    const std::vector<std::string> help_text = {"c: capture", "w: save captured", "p: pause", "r: reset everything", "s: segment captured", "y: run yolo on captured", "v: run video capture", "t: toggle segmentation of live frames", "Q/ESC: exit"};
 
     if (!startFlyCapture(camera)) { //start camera
         std::cerr << "Could not start fly capture camera! " << std::endl;
@@ -94,7 +96,7 @@ int main(int argc, char * argv[]) {
                 pause_camera = false;
             } else {
                 cv::destroyAllWindows();
-                run_segmentation = run_yolo = pause_camera = capture_frame = save_captured = video_capture = false;
+                run_segmentation = stream_segmentation = run_yolo = pause_camera = capture_frame = save_captured = video_capture = false;
             }
             if (video_capture) {
                 img_video.release();
@@ -107,6 +109,9 @@ int main(int argc, char * argv[]) {
             save_captured = true;
         } else if (key == 'y') { //run yolo
             run_yolo = true;
+        } else if (key == 't') { //segment every frame - reusing work from previous frame
+            stream_segmentation = !stream_segmentation;
+            segmentation_stream.reset();
         } else if (key == 'v' && !video_capture) {
             sprintf(save_name, save_file_format_video, save_count++);
             img_video.open(save_name, -1, 20, cv::Size(frame.cols, frame.rows), true);
@@ -154,6 +159,17 @@ int main(int argc, char * argv[]) {
             run_segmentation = false;
         }
 
+        if (stream_segmentation && !pause_camera) {
+            t1 = std::chrono::high_resolution_clock::now();
+            Segmentation::processStream(frame, segmentation_regions, segmentation_scores, segmentation_stream);
+            t2 = std::chrono::high_resolution_clock::now();
+
+            duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+            std::cout << "Stream Segmentation Time: " << duration / 1000 << "s | tiles changed: " << segmentation_stream.tiles_changed << "/" << segmentation_stream.tiles_total << " | reused/recomputed: " << segmentation_stream.getReuseRatio() << std::endl;
+
+            Segmentation::showSegmentationResults(frame, segmentation_regions, segmentation_scores, "stream_segmentation");
+        }
+
         if (run_yolo) { //run yolo on captured image
             if (!yolo)
                 yolo = new YoloInterface(configFile, weightsFile, labelFile);
@@ -0,0 +1,83 @@
+#include "functions.h"
+#include "segmentation.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+//compares latency & recall of plain segmentation at several resolutions against coarse-to-fine mode
+//ground truth file format (one image per line): image_path x y w h [x y w h ...]
+
+struct BenchmarkResult {
+    std::string name;
+    double total_ms = 0;
+    double total_recall = 0;
+    double total_proposals = 0;
+};
+
+int main(int argc, char * argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " ground_truth_file" << std::endl;
+        return -1;
+    }
+
+    std::ifstream f(argv[1]);
+    CV_Assert(f.is_open());
+
+    std::vector<std::string> img_files;
+    std::vector< std::vector<cv::Rect> > ground_truths;
+
+    std::string line;
+    while (std::getline(f, line)) {
+        std::istringstream ss(line);
+        std::string img_file;
+        if (!(ss >> img_file))
+            continue;
+
+        std::vector<cv::Rect> gt;
+        cv::Rect r;
+        while (ss >> r.x >> r.y >> r.width >> r.height)
+            gt.push_back(r);
+
+        img_files.push_back(img_file);
+        ground_truths.push_back(gt);
+    }
+
+    const std::vector<int> plain_heights = {200, 400, 800};
+    std::vector<BenchmarkResult> results(plain_heights.size() + 1);
+    for (unsigned int i = 0; i < plain_heights.size(); ++i)
+        results[i].name = "resize_h=" + std::to_string(plain_heights[i]);
+    results.back().name = "coarse_to_fine(200->800)";
+
+    std::vector<cv::Rect> proposals;
+    std::vector<float> scores;
+    std::chrono::high_resolution_clock::time_point t1, t2;
+
+    for (unsigned int i = 0; i < img_files.size(); ++i) {
+        const cv::Mat img = cv::imread(img_files[i]);
+        if (img.empty()) {
+            std::cerr << "Could not read: " << img_files[i] << std::endl;
+            continue;
+        }
+
+        for (unsigned int m = 0; m < results.size(); ++m) {
+            t1 = std::chrono::high_resolution_clock::now();
+            if (m < plain_heights.size())
+                Segmentation::process(img, proposals, scores, plain_heights[m]);
+            else
+                Segmentation::processCoarseToFine(img, proposals, scores, 200, 800);
+            t2 = std::chrono::high_resolution_clock::now();
+
+            results[m].total_ms += std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
+            results[m].total_recall += Segmentation::getRecall(proposals, ground_truths[i]);
+            results[m].total_proposals += proposals.size();
+        }
+    }
+
+    const double n = std::max<double>(img_files.size(), 1);
+    std::printf("%-28s %12s %12s %12s\n", "method", "latency(ms)", "recall@0.5", "proposals");
+    for (const BenchmarkResult &r : results)
+        std::printf("%-28s %12.1f %12.3f %12.1f\n", r.name.c_str(), r.total_ms / n, r.total_recall / n, r.total_proposals / n);
+
+    return 0;
+}
@@ -4,22 +4,321 @@
 
 #include <opencv2/ximgproc/segmentation.hpp>
 
+#include <future>
+#include <numeric>
+
 namespace Segmentation {
 
-    float RegionProposal::total_merge_scores = 0;
-    int RegionProposal::img_area = 0;
+    thread_local float RegionProposal::total_merge_scores = 0;
+    thread_local int RegionProposal::img_area = 0;
 
-    void process(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores) {
-        std::vector<cv::Mat> img_domains;
-        const int resize_h = 200;
+    //graph segmentation parameters shared by single image and stream processing
+    static const float seg_k_base = 600, seg_k_step = 100;
+    static const std::vector<float> seg_sigma_vals = {0.8, 0.8, 0.5, 0.5, 0.8, 0.5};
+
+    StreamState::StreamState(float change_threshold, int grid, int keyframe, float max_changed) : change_thresh(change_threshold), grid_size(grid), keyframe_interval(keyframe), max_changed_fraction(max_changed) {
+        reset();
+    }
+
+    void StreamState::reset(void) {
+        frame_count = 0;
+        prev_bgr.release();
+        domains.clear();
+        k_values.clear();
+        segmentations.clear();
+        raw_proposals.clear();
+        raw_proposal_labels.clear();
+        tiles_changed = tiles_total = 0;
+        pixels_reused = pixels_recomputed = 0;
+    }
+
+    void process(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, int resize_h) {
+        //kept per thread so domain buffers are reused across calls with the same frame size
+        static thread_local std::vector<cv::Mat> img_domains;
         const int resize_w = img.cols * resize_h / img.rows;
-        getDomains(img, img_domains, resize_h);
+        getDomainsFused(img, img_domains, resize_h);
 
         std::vector< std::vector<cv::Mat> > img_segmentations; //[domain][k-value]
         getSegmentations(img_domains, img_segmentations);
 
         std::vector<RegionProposal> img_proposals;
         generateRegionProposals(img_segmentations, img_proposals);
+
+        mergeRegionProposals(img_proposals, proposals, scores);
+
+        resizeRegions(proposals, img.cols, img.rows, resize_w, resize_h);
+    }
+
+    void processCoarseToFine(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, int coarse_h, int fine_h, unsigned int max_refinements) {
+        const cv::Rect img_rect(0, 0, img.cols, img.rows);
+        const float fine_scale = float(fine_h) / img.rows;
+        const float context = 0.5; //extra neighbourhood around coarse proposal on each side (relative to its size)
+        const int min_refine_h = 64; //smallest height a neighbourhood is segmented at
+
+        std::vector<cv::Rect> coarse_proposals;
+        std::vector<float> coarse_scores;
+        process(img, coarse_proposals, coarse_scores, coarse_h);
+
+        //pick neighbourhoods of best coarse proposals - skip ones mostly covered by an already picked neighbourhood
+        std::vector<unsigned int> order(coarse_proposals.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&coarse_scores](unsigned int i1, unsigned int i2)->bool {
+            return coarse_scores[i1] > coarse_scores[i2];
+        });
+
+        std::vector<cv::Rect> neighbourhoods;
+        std::vector<float> neighbourhood_scores;
+        for (unsigned int i : order) {
+            if (neighbourhoods.size() >= max_refinements)
+                break;
+
+            const cv::Rect &r = coarse_proposals[i];
+            const int dx = r.width * context, dy = r.height * context;
+            const cv::Rect n = cv::Rect(r.x - dx, r.y - dy, r.width + 2 * dx, r.height + 2 * dy) & img_rect;
+            if (n.empty())
+                continue;
+
+            bool covered = false;
+            for (const cv::Rect &picked : neighbourhoods) {
+                if ((picked & n).area() > 0.8 * n.area()) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (!covered) {
+                neighbourhoods.push_back(n);
+                neighbourhood_scores.push_back(coarse_scores[i]);
+            }
+        }
+
+        //refine every neighbourhood as its own task
+        std::vector< std::future< std::pair< std::vector<cv::Rect>, std::vector<float> > > > refinements;
+        for (unsigned int i = 0; i < neighbourhoods.size(); ++i) {
+            refinements.emplace_back(std::async(std::launch::async, [&img, &neighbourhoods, &neighbourhood_scores, i, fine_scale, min_refine_h]() {
+                const cv::Rect &n = neighbourhoods[i];
+                std::pair< std::vector<cv::Rect>, std::vector<float> > refined;
+                process(img(n), refined.first, refined.second, std::max(int(n.height * fine_scale), min_refine_h));
+
+                for (unsigned int j = 0; j < refined.first.size(); ++j) {
+                    refined.first[j] += n.tl(); //back to full image coordinates
+                    refined.second[j] *= neighbourhood_scores[i]; //weight by coarse proposal it came from
+                }
+                return refined;
+            }));
+        }
+
+        //merge results - proposals matching one already kept only raise its score
+        proposals = coarse_proposals;
+        scores = coarse_scores;
+        const float IOU_thresh = 0.7;
+        for (std::future< std::pair< std::vector<cv::Rect>, std::vector<float> > > &refinement : refinements) {
+            const std::pair< std::vector<cv::Rect>, std::vector<float> > refined = refinement.get();
+
+            for (unsigned int j = 0; j < refined.first.size(); ++j) {
+                const cv::Rect &r = refined.first[j];
+
+                unsigned int match = 0;
+                for (; match < proposals.size(); ++match) {
+                    const float I = (r & proposals[match]).area();
+                    const float U = (r | proposals[match]).area();
+                    if (I / U >= IOU_thresh)
+                        break;
+                }
+
+                if (match == proposals.size()) {
+                    proposals.push_back(r);
+                    scores.push_back(refined.second[j]);
+                } else {
+                    scores[match] = std::max(scores[match], refined.second[j]);
+                }
+            }
+        }
+    }
+
+    void processStream(const cv::Mat &img, std::vector<cv::Rect> &proposals, std::vector<float> &scores, StreamState &state) {
+        const int resize_h = 200;
+        const int resize_w = img.cols * resize_h / img.rows;
+        const unsigned int seg_levels = 5;
+        getDomainsFused(img, state.domains, resize_h);
+
+        const cv::Rect img_rect(0, 0, resize_w, resize_h);
+        const double img_area = img_rect.area();
+
+        //decide between full re-segmentation and patching changed tiles
+        bool full = state.segmentations.size() != state.domains.size() || state.prev_bgr.size() != state.domains[0].size() || state.frame_count % state.keyframe_interval == 0;
+        std::vector<cv::Rect> dirty; //patches to re-segment - one per group of touching changed tiles
+        double dirty_area = 0;
+
+        state.tiles_total = state.grid_size * state.grid_size;
+        state.tiles_changed = full ? state.tiles_total : 0;
+        if (!full) {
+            const int grid = state.grid_size;
+            cv::Mat diff;
+            cv::absdiff(state.domains[0], state.prev_bgr, diff);
+
+            std::vector<bool> changed(state.tiles_total, false);
+            for (int gy = 0; gy < grid; ++gy) {
+                for (int gx = 0; gx < grid; ++gx) {
+                    const int x0 = gx * resize_w / grid, x1 = (gx + 1) * resize_w / grid;
+                    const int y0 = gy * resize_h / grid, y1 = (gy + 1) * resize_h / grid;
+                    const cv::Rect tile(x0, y0, x1 - x0, y1 - y0);
+
+                    const cv::Scalar tile_diff = cv::mean(diff(tile));
+                    if ((tile_diff[0] + tile_diff[1] + tile_diff[2]) / 3 > state.change_thresh) {
+                        ++state.tiles_changed;
+                        changed[gy * grid + gx] = true;
+                    }
+                }
+            }
+
+            //group 4-connected changed tiles - scattered changes stay separate small patches instead of one box around all of them
+            const int margin = 4;
+            std::vector<bool> grouped(state.tiles_total, false);
+            std::vector<int> stack;
+            for (int t = 0; t < state.tiles_total; ++t) {
+                if (!changed[t] || grouped[t])
+                    continue;
+
+                int gx0 = t % grid, gx1 = gx0, gy0 = t / grid, gy1 = gy0;
+                grouped[t] = true;
+                stack.push_back(t);
+                while (!stack.empty()) {
+                    const int cx = stack.back() % grid, cy = stack.back() / grid;
+                    stack.pop_back();
+                    gx0 = std::min(gx0, cx), gx1 = std::max(gx1, cx);
+                    gy0 = std::min(gy0, cy), gy1 = std::max(gy1, cy);
+
+                    const int neighbours[4][2] = {{cx - 1, cy}, {cx + 1, cy}, {cx, cy - 1}, {cx, cy + 1}};
+                    for (const int (&n)[2] : neighbours) {
+                        const int nt = n[1] * grid + n[0];
+                        if (n[0] >= 0 && n[0] < grid && n[1] >= 0 && n[1] < grid && changed[nt] && !grouped[nt]) {
+                            grouped[nt] = true;
+                            stack.push_back(nt);
+                        }
+                    }
+                }
+
+                //grow patch so segments are not cut right at the changed pixels
+                const int x0 = gx0 * resize_w / grid - margin, x1 = (gx1 + 1) * resize_w / grid + margin;
+                const int y0 = gy0 * resize_h / grid - margin, y1 = (gy1 + 1) * resize_h / grid + margin;
+                dirty.push_back(cv::Rect(x0, y0, x1 - x0, y1 - y0) & img_rect);
+            }
+
+            //grown patches can overlap - merge them so every pixel is re-segmented and spliced once
+            for (bool merged = true; merged;) {
+                merged = false;
+                for (unsigned int i = 0; i < dirty.size(); ++i) {
+                    for (unsigned int j = i + 1; j < dirty.size(); ++j) {
+                        if ((dirty[i] & dirty[j]).area() > 0) {
+                            dirty[i] |= dirty[j];
+                            dirty.erase(dirty.begin() + j--);
+                            merged = true;
+                        }
+                    }
+                }
+            }
+
+            for (const cv::Rect &patch : dirty)
+                dirty_area += patch.area();
+
+            full = state.tiles_changed > state.max_changed_fraction * state.tiles_total || dirty_area > state.max_changed_fraction * img_area;
+        }
+
+        std::vector<float> segmentation_weights(seg_levels);
+        for (int w = 0; w < segmentation_weights.size(); ++w)
+            segmentation_weights[w] = 1 / (1 + std::exp(-float(w + 1) / 4)); //weight per segmentation level.
+
+        state.segmentations.resize(state.domains.size(), std::vector<cv::Mat>(seg_levels));
+        state.raw_proposals.resize(state.domains.size(), std::vector< std::vector<RegionProposal> >(seg_levels));
+        state.raw_proposal_labels.resize(state.domains.size(), std::vector< std::vector<int> >(seg_levels));
+        state.k_values.resize(state.domains.size(), seg_k_base);
+        state.pixels_reused = state.pixels_recomputed = 0;
+
+        cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> gs = cv::ximgproc::segmentation::createGraphSegmentation();
+
+        for (unsigned int d = 0; d < state.domains.size(); ++d) {
+            gs->setSigma(seg_sigma_vals[d]);
+
+            if (full) {
+                //warm start k search from value found in previous frame
+                float k = state.k_values[d] = segmentWithAutoK(gs, state.domains[d], state.segmentations[d][0], state.k_values[d]);
+                for (unsigned int s = 1; s < seg_levels; ++s) {
+                    gs->setK(k += seg_k_step);
+                    gs->processImage(state.domains[d], state.segmentations[d][s]);
+                }
+
+                for (unsigned int s = 0; s < seg_levels; ++s) {
+                    state.raw_proposals[d][s].clear();
+                    state.raw_proposal_labels[d][s].clear();
+                    generateSegmentationProposals(state.segmentations[d][s], segmentation_weights[s], d, s, state.raw_proposals[d][s], state.raw_proposal_labels[d][s]);
+                }
+                state.pixels_recomputed += seg_levels * img_area;
+            } else if (dirty.empty()) {
+                state.pixels_reused += seg_levels * img_area; //nothing changed - reuse label maps and proposals
+            } else {
+                for (unsigned int s = 0; s < seg_levels; ++s) {
+                    cv::Mat &img_seg = state.segmentations[d][s];
+
+                    //labels that currently have pixels in patch need their proposals regenerated
+                    double min, max;
+                    cv::minMaxLoc(img_seg, &min, &max);
+                    std::vector<bool> affected_labels(int(max) + 1, false);
+                    for (const cv::Rect &patch : dirty) {
+                        for (int i = patch.y; i < patch.y + patch.height; ++i) {
+                            const int32_t * ptr_seg = img_seg.ptr<int32_t>(i);
+                            for (int j = patch.x; j < patch.x + patch.width; ++j)
+                                affected_labels[ptr_seg[j]] = true;
+                        }
+                    }
+
+                    //re-segment each patch on its own and splice it in with new labels
+                    gs->setK(state.k_values[d] + s * seg_k_step);
+                    for (const cv::Rect &patch : dirty) {
+                        cv::Mat patch_seg;
+                        gs->processImage(state.domains[d](patch), patch_seg);
+                        cv::Mat img_seg_patch = img_seg(patch);
+                        cv::add(patch_seg, cv::Scalar(int(max) + 1), img_seg_patch);
+
+                        double patch_min, patch_max;
+                        cv::minMaxLoc(patch_seg, &patch_min, &patch_max);
+                        max += patch_max + 1;
+                    }
+                    affected_labels.resize(int(max) + 1, true); //all new labels are affected
+
+                    //drop proposals from affected labels and regenerate only those
+                    std::vector<RegionProposal> &raw = state.raw_proposals[d][s];
+                    std::vector<int> &raw_labels = state.raw_proposal_labels[d][s];
+                    unsigned int kept = 0;
+                    for (unsigned int i = 0; i < raw.size(); ++i) {
+                        if (!affected_labels[raw_labels[i]]) {
+                            raw[kept] = raw[i];
+                            raw_labels[kept++] = raw_labels[i];
+                        }
+                    }
+                    raw.erase(raw.begin() + kept, raw.end());
+                    raw_labels.erase(raw_labels.begin() + kept, raw_labels.end());
+
+                    generateSegmentationProposals(img_seg, segmentation_weights[s], d, s, raw, raw_labels, affected_labels);
+                }
+                state.pixels_recomputed += seg_levels * dirty_area;
+                state.pixels_reused += seg_levels * (img_area - dirty_area);
+            }
+        }
+
+        state.domains[0].copyTo(state.prev_bgr);
+        ++state.frame_count;
+
+        std::vector<RegionProposal> img_proposals;
+        for (const std::vector< std::vector<RegionProposal> > &domain_proposals : state.raw_proposals)
+            for (const std::vector<RegionProposal> &level_proposals : domain_proposals)
+                img_proposals.insert(img_proposals.end(), level_proposals.begin(), level_proposals.end());
+
+        mergeRegionProposals(img_proposals, proposals, scores);
+
+        resizeRegions(proposals, img.cols, img.rows, resize_w, resize_h);
+    }
+
+    void mergeRegionProposals(std::vector<RegionProposal> &img_proposals, std::vector<cv::Rect> &proposals, std::vector<float> &scores) {
         RegionProposal::total_merge_scores = 0;
 
         mergeProposalsWithinSegmentationLevel(img_proposals); //merge within same segmentation domain - different domains
@@ -29,8 +328,6 @@ namespace Segmentation {
         mergeProposalsCommonThroughoutDomain(img_proposals); //merge proposals found in all segmentation levels of a single domain
 
         getSignificantMergedRegions(img_proposals, proposals, scores); //get only regions merged between segmentation levels
-
-        resizeRegions(proposals, img.cols, img.rows, resize_w, resize_h);
     }
 
     cv::Mat showSegmentationResults(const cv::Mat &img, const std::vector<cv::Rect> &proposals, const std::vector<float> &scores, const std::string &window_name, unsigned int display_outline_thickness, bool show_scores) {
@@ -93,44 +390,92 @@ namespace Segmentation {
         cv::cvtColor(img_domains[0], img_domains[5], cv::COLOR_BGR2YCrCb);
     }
 
+    void getDomainsFused(const cv::Mat &img, std::vector<cv::Mat> &img_domains, int resize_h) {
+        const int resize_w = img.cols * resize_h / img.rows;
+        RegionProposal::img_area = resize_h * resize_w;
+
+        //keep old domain images so their buffers are reused when frame size does not change
+        img_domains.resize(6); //6 Domains [BGR, HSV, LAB, I, RGI, YCrCb]
+
+        //BGR - only pass over full size input
+        cv::resize(img, img_domains[0], cv::Size(resize_w, resize_h));
+
+        img_domains[1].create(resize_h, resize_w, CV_8UC3);
+        img_domains[2].create(resize_h, resize_w, CV_8UC3);
+        img_domains[3].create(resize_h, resize_w, CV_8UC1);
+        img_domains[4].create(resize_h, resize_w, CV_8UC3);
+        img_domains[5].create(resize_h, resize_w, CV_8UC3);
+
+        //convert tiles of rows small enough to stay in cache while all domains are built from them
+        const int tile_rows = 16;
+        const int num_tiles = (resize_h + tile_rows - 1) / tile_rows;
+
+        cv::parallel_for_(cv::Range(0, num_tiles), [&](const cv::Range & tiles) {
+            for (int t = tiles.start; t < tiles.end; ++t) {
+                const cv::Range rows(t * tile_rows, std::min((t + 1) * tile_rows, resize_h));
+                const cv::Mat bgr = img_domains[0].rowRange(rows);
+
+                //outputs are views into the preallocated domains - cvtColor writes in place (vectorized in OpenCV)
+                cv::Mat hsv = img_domains[1].rowRange(rows), lab = img_domains[2].rowRange(rows), I = img_domains[3].rowRange(rows);
+                cv::Mat rgi = img_domains[4].rowRange(rows), ycrcb = img_domains[5].rowRange(rows);
+
+                cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+                cv::cvtColor(bgr, lab, cv::COLOR_BGR2Lab);
+                cv::cvtColor(bgr, I, cv::COLOR_BGR2GRAY);
+                cv::cvtColor(bgr, ycrcb, cv::COLOR_BGR2YCrCb);
+
+                //RGI straight from tile - no split/merge temporaries
+                const cv::Mat rgi_src[2] = {bgr, I};
+                const int rgi_from_to[6] = {2, 0, 1, 1, 3, 2};
+                cv::mixChannels(rgi_src, 2, &rgi, 1, rgi_from_to, 3);
+            }
+        });
+    }
+
     void getSegmentations(const std::vector<cv::Mat> &img_domains, std::vector< std::vector<cv::Mat> > &segmentations, unsigned int seg_levels) {
-        const float k_base = 600, k_step = 100;
-        const std::vector <float> sigma_vals = {0.8, 0.8, 0.5, 0.5, 0.8, 0.5};
         segmentations.resize(img_domains.size(), std::vector<cv::Mat>(seg_levels));
 
         cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> gs = cv::ximgproc::segmentation::createGraphSegmentation();
 
         for (unsigned int i_domain = 0; i_domain < img_domains.size(); ++i_domain) {
-            gs->setSigma(sigma_vals[i_domain]);
-
-            float k = k_base;
-            for (unsigned int i_seg = 0; i_seg < seg_levels; ++i_seg, k += k_step) {
-                gs->setK(k);
-                gs->processImage(img_domains[i_domain], segmentations[i_domain][i_seg]);
+            gs->setSigma(seg_sigma_vals[i_domain]);
 
+            float k = seg_k_base;
+            for (unsigned int i_seg = 0; i_seg < seg_levels; ++i_seg, k += seg_k_step) {
                 if (i_seg == 0) {
-                    double min, max;
-                    cv::minMaxLoc(segmentations[i_domain][i_seg], &min, &max);
-                    if (max < 10) {
-                        while (max < 10 && k > k_step) {
-                            k -= k_step;
-                            gs->setK(k);
-                            gs->processImage(img_domains[i_domain], segmentations[i_domain][i_seg]);
-                            cv::minMaxLoc(segmentations[i_domain][i_seg], &min, &max);
-                        }
-                    } else if (max >= 20) {
-                        while (max >= 20) {
-                            k += k_step;
-                            gs->setK(k);
-                            gs->processImage(img_domains[i_domain], segmentations[i_domain][i_seg]);
-                            cv::minMaxLoc(segmentations[i_domain][i_seg], &min, &max);
-                        }
-                    }
+                    k = segmentWithAutoK(gs, img_domains[i_domain], segmentations[i_domain][i_seg], k);
+                } else {
+                    gs->setK(k);
+                    gs->processImage(img_domains[i_domain], segmentations[i_domain][i_seg]);
                 }
             }
         }
     }
 
+    float segmentWithAutoK(cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> &gs, const cv::Mat &img_domain, cv::Mat &img_seg, float k) {
+        gs->setK(k);
+        gs->processImage(img_domain, img_seg);
+
+        double min, max;
+        cv::minMaxLoc(img_seg, &min, &max);
+        if (max < 10) {
+            while (max < 10 && k > seg_k_step) {
+                k -= seg_k_step;
+                gs->setK(k);
+                gs->processImage(img_domain, img_seg);
+                cv::minMaxLoc(img_seg, &min, &max);
+            }
+        } else if (max >= 20) {
+            while (max >= 20) {
+                k += seg_k_step;
+                gs->setK(k);
+                gs->processImage(img_domain, img_seg);
+                cv::minMaxLoc(img_seg, &min, &max);
+            }
+        }
+        return k;
+    }
+
     void getBoundingBoxes(const cv::Mat &img_seg, std::vector<cv::Rect> &boxes, float max_region_size) {
         double min, max;
         cv::minMaxLoc(img_seg, &min, &max);
@@ -183,53 +528,57 @@ namespace Segmentation {
         for (int w = 0; w < segmentation_weights.size(); ++w)
             segmentation_weights[w] = 1 / (1 + std::exp(-float(w + 1) / 4)); //weight per segmentation level.
 
-        double min, max;
-        int num_segs;
+        std::vector<int> proposal_labels; //not needed
+
+        for (unsigned int d = 0; d < segmentations.size(); ++d) //domain
+            for (unsigned int s = 0; s < segmentations[d].size(); ++s) //segmentation
+                generateSegmentationProposals(segmentations[d][s], segmentation_weights[s], d, s, proposals, proposal_labels, std::vector<bool>(), max_region_size);
+    }
+
+    void generateSegmentationProposals(const cv::Mat &img_seg, float score, int domain, int seg_level, std::vector<RegionProposal> &proposals, std::vector<int> &proposal_labels, const std::vector<bool> &consider_labels, float max_region_size) {
         const float side_ignore_size = 3; //size to ignore any regions that touch boundaries of image
 
-        for (unsigned int d = 0; d < segmentations.size(); ++d) { //domain
-            for (unsigned int s = 0; s < segmentations[d].size(); ++s) { //segmentation
-                const cv::Mat img_seg = segmentations[d][s];
+        double min, max;
+        cv::minMaxLoc(img_seg, &min, &max);
+        const int num_segs = max + 1;
 
-                cv::minMaxLoc(img_seg, &min, &max);
-                num_segs = max + 1;
-
-                const int max_points = max_region_size * img_seg.rows * img_seg.cols;
-
-                std::unordered_map< int, std::vector<cv::Point> > seg_points_map;
-                for (int i = 0; i < num_segs; ++i)
-                    seg_points_map[i]; //create entry for every segment in map
-
-                const uint32_t * ptr_seg;
-                std::unordered_map< int, std::vector<cv::Point> >::iterator seg_points;
-
-                for (unsigned int i = 0; i < img_seg.rows; ++i) {
-                    ptr_seg = img_seg.ptr<uint32_t>(i);
-
-                    for (unsigned int j = 0; j < img_seg.cols; ++j) {
-                        int seg = ptr_seg[j];
-                        seg_points = seg_points_map.find(seg);
-                        if (seg_points != seg_points_map.end()) { //only concern ourselves with valid regions
-                            if (i < side_ignore_size || i > img_seg.rows - side_ignore_size || j < side_ignore_size || j > img_seg.cols - side_ignore_size) {
-                                seg_points_map.erase(seg_points); //segment is near the edge - erase from map
-                            } else {
-                                if (seg_points->second.size() > max_points)
-                                    seg_points_map.erase(seg_points); //segment has too many points - erase from map
-                                else
-                                    seg_points->second.push_back(cv::Point(j, i)); //add point to corresponding region
-                            }
-                        }
+        const int max_points = max_region_size * img_seg.rows * img_seg.cols;
+
+        std::unordered_map< int, std::vector<cv::Point> > seg_points_map;
+        for (int i = 0; i < num_segs; ++i)
+            if (consider_labels.empty() || (i < consider_labels.size() && consider_labels[i]))
+                seg_points_map[i]; //create entry for every segment in map
+
+        const uint32_t * ptr_seg;
+        std::unordered_map< int, std::vector<cv::Point> >::iterator seg_points;
+
+        for (unsigned int i = 0; i < img_seg.rows; ++i) {
+            ptr_seg = img_seg.ptr<uint32_t>(i);
+
+            for (unsigned int j = 0; j < img_seg.cols; ++j) {
+                int seg = ptr_seg[j];
+                seg_points = seg_points_map.find(seg);
+                if (seg_points != seg_points_map.end()) { //only concern ourselves with valid regions
+                    if (i < side_ignore_size || i > img_seg.rows - side_ignore_size || j < side_ignore_size || j > img_seg.cols - side_ignore_size) {
+                        seg_points_map.erase(seg_points); //segment is near the edge - erase from map
+                    } else {
+                        if (seg_points->second.size() > max_points)
+                            seg_points_map.erase(seg_points); //segment has too many points - erase from map
+                        else
+                            seg_points->second.push_back(cv::Point(j, i)); //add point to corresponding region
                     }
                 }
+            }
+        }
 
-                //create bounding rectangle based on points in map
-                for (const std::pair< int, std::vector<cv::Point> > &p : seg_points_map) {
-                    cv::Rect box = cv::boundingRect(p.second);
-                    //only predict region if is bigger than a minimal dimensional size and contains enough salient points
+        //create bounding rectangle based on points in map
+        for (const std::pair< int, std::vector<cv::Point> > &p : seg_points_map) {
+            cv::Rect box = cv::boundingRect(p.second);
+            //only predict region if is bigger than a minimal dimensional size and contains enough salient points
 
-                    if (box.width > img_seg.rows * 0.02 && box.height > img_seg.cols * 0.02 && float(p.second.size()) / box.area() > 0.15)
-                        proposals.emplace_back(box, segmentation_weights[s], d, s);
-                }
+            if (box.width > img_seg.rows * 0.02 && box.height > img_seg.cols * 0.02 && float(p.second.size()) / box.area() > 0.15) {
+                proposals.emplace_back(box, score, domain, seg_level);
+                proposal_labels.push_back(p.first);
             }
         }
     }
@@ -391,6 +740,24 @@ namespace Segmentation {
             resizeRegion(r, original_w, original_h, resize_w, resize_h);
     }
 
+    float getRecall(const std::vector<cv::Rect> &proposals, const std::vector<cv::Rect> &ground_truth, float IOU_thresh) {
+        if (ground_truth.empty())
+            return 1;
+
+        unsigned int found = 0;
+        for (const cv::Rect &gt : ground_truth) {
+            for (const cv::Rect &p : proposals) {
+                float I = (gt & p).area();
+                float U = (gt | p).area();
+                if (U > 0 && I / U >= IOU_thresh) {
+                    ++found;
+                    break;
+                }
+            }
+        }
+        return float(found) / ground_truth.size();
+    }
+
     //helper function for mergeProposalsCommonThroughoutDomain
     //all regions between domain_start and domain_end must belong to same domain - should be sorted by segmentation_level
 
@@ -7,100 +7,298 @@
 
 namespace SegmentationCV {
 
-    std::vector<cv::Mat> m_images;
-    std::vector<cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> > m_segmentations;
-    std::vector<cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategy> > m_strategies;
-
 #ifdef DEBUG_SEGMENTATION
+    std::vector<cv::Mat> m_images;
     std::vector<cv::Mat> debugDisp1, debugDisp2;
 #endif
 
     //helper functions
 
-    void switchToSelectiveSearchQuality(const cv::Mat & base_image, const int base_k, const int inc_k, const float sigma) {
-        m_images.clear();
-        m_segmentations.clear();
-        m_strategies.clear();
-        m_images.reserve(5);
+    // Entry of hierarchicalGrouping's priority queue - highest similarity first, then earliest inserted
+
+    struct QueuedNeighbor {
+        Neighbor neighbor;
+        unsigned int sequence;
+
+        bool operator<(const QueuedNeighbor & q) const {
+            return (neighbor.similarity == q.neighbor.similarity) ? (sequence > q.sequence) : (neighbor.similarity < q.neighbor.similarity);
+        }
+    };
+
+    // Similarity/merge state of one grouping run - starts from shared features and only copies what the strategy uses
+
+    class GroupingState {
+    public:
+
+        GroupingState(const SegmentationFeatures & f, const StrategyWeights & w) : features(f), weights(w), sizes(f.sizes.clone()), bounding_rects(f.bounding_rects) {
+            if (weights.color > 0)
+                color_hists = f.color_hists.clone();
+            if (weights.texture > 0)
+                texture_hists = f.texture_hists.clone();
+        }
+
+        float get(int r1, int r2) const {
+            float similarity = 0;
+            if (weights.color > 0)
+                similarity += weights.color * histogramIntersection(color_hists, r1, r2);
+            if (weights.texture > 0)
+                similarity += weights.texture * histogramIntersection(texture_hists, r1, r2);
+            if (weights.fill > 0) {
+                const cv::Rect bounding_rect = bounding_rects[r1] | bounding_rects[r2];
+                similarity += weights.fill * std::max(0.f, std::min(1.f, 1.f - float(bounding_rect.area() - sizes(r1, 0) - sizes(r2, 0)) / features.img_size));
+            }
+            if (weights.size > 0)
+                similarity += weights.size * std::max(0.f, std::min(1.f, 1.f - float(sizes(r1, 0) + sizes(r2, 0)) / features.img_size));
+            return similarity;
+        }
+
+        void merge(int r1, int r2) {
+            if (weights.color > 0)
+                mergeHistograms(color_hists, r1, r2);
+            if (weights.texture > 0)
+                mergeHistograms(texture_hists, r1, r2);
+            bounding_rects[r1] = bounding_rects[r2] = bounding_rects[r1] | bounding_rects[r2];
+
+            // Same size update as the original OpenCV based grouping
+            sizes(r1, 0) += sizes(r2, 0);
+            sizes(r2, 0) += sizes(r1, 0);
+        }
+
+    private:
+        const SegmentationFeatures & features;
+        const StrategyWeights weights;
+
+        cv::Mat_<int32_t> sizes;
+        std::vector<cv::Rect> bounding_rects;
+        cv::Mat_<float> color_hists;
+        cv::Mat_<float> texture_hists;
+
+        static float histogramIntersection(const cv::Mat_<float> & hists, int r1, int r2) {
+            const float * h1 = hists[r1], * h2 = hists[r2];
+            float intersection = 0;
+            for (int i = 0; i < hists.cols; ++i)
+                intersection += std::min(h1[i], h2[i]);
+            return intersection;
+        }
+
+        void mergeHistograms(cv::Mat_<float> & hists, int r1, int r2) const {
+            float * h1 = hists[r1], * h2 = hists[r2];
+            const float size_r1 = sizes(r1, 0), size_r2 = sizes(r2, 0);
+            for (int i = 0; i < hists.cols; ++i)
+                h1[i] = h2[i] = (h1[i] * size_r1 + h2[i] * size_r2) / (size_r1 + size_r2);
+        }
+    };
+
+    // Per region histogram of all channels of img (values binned over [0, 256)), normalized to sum to 1 - single pass over image
+
+    void computeRegionHistograms(const std::vector<cv::Mat> & planes, const cv::Mat & img_regions, int nb_segs, int nb_bins, cv::Mat_<float> & hists) {
+        hists = cv::Mat_<float>::zeros(nb_segs, int(planes.size()) * nb_bins);
+
+        for (unsigned int p = 0; p < planes.size(); ++p) {
+            for (int i = 0; i < img_regions.rows; ++i) {
+                const int32_t * ptr_region = img_regions.ptr<int32_t>(i);
+                const uint8_t * ptr_plane = planes[p].ptr<uint8_t>(i);
+
+                for (int j = 0; j < img_regions.cols; ++j)
+                    ++hists(ptr_region[j], p * nb_bins + ptr_plane[j] * nb_bins / 256);
+            }
+        }
+
+        for (int r = 0; r < nb_segs; ++r) {
+            float * h = hists[r];
+            float sum = 0;
+            for (int i = 0; i < hists.cols; ++i)
+                sum += h[i];
+            if (sum > 0)
+                for (int i = 0; i < hists.cols; ++i)
+                    h[i] /= sum;
+        }
+    }
+
+    // Split positive and negative part of derivative into 8-bit images stretched to [0, 255]
+
+    void addDerivativeParts(const cv::Mat & derivative, std::vector<cv::Mat> & parts) {
+        cv::Mat pos, neg;
+        cv::threshold(derivative, pos, 0, 0, cv::THRESH_TOZERO);
+        cv::threshold(derivative, neg, 0, 0, cv::THRESH_TOZERO_INV);
+
+        for (const cv::Mat & part : {pos, neg}) {
+            double min, max;
+            cv::minMaxLoc(part, &min, &max);
+            cv::Mat part_8u;
+            if (max > min)
+                part.convertTo(part_8u, CV_8U, 255 / (max - min), -255 * min / (max - min));
+            else
+                part_8u = cv::Mat::zeros(part.size(), CV_8U);
+            parts.push_back(part_8u);
+        }
+    }
+
+    void computeFeatures(const cv::Mat & img, const cv::Mat & img_regions, SegmentationFeatures & features) {
+        double min, max;
+        cv::minMaxLoc(img_regions, &min, &max);
+        const int nb_segs = int(max) + 1;
+
+        features.img_size = img.rows * img.cols;
+        features.sizes = cv::Mat_<int32_t>::zeros(nb_segs, 1);
+
+        // Bounding rectangles, sizes and neighbor pairs (same pixel neighborhood as before)
+        std::vector<cv::Point> tl(nb_segs, cv::Point(img_regions.cols, img_regions.rows)), br(nb_segs, cv::Point(-1, -1));
+        std::vector<std::pair<int32_t, int32_t> > edges;
+
+        const int32_t * previous_p = nullptr, * p;
+        for (int i = 0; i < img_regions.rows; ++i) {
+            p = img_regions.ptr<int32_t>(i);
+
+            for (int j = 0; j < img_regions.cols; ++j) {
+                const int32_t r = p[j];
+                ++features.sizes(r, 0);
+                tl[r].x = std::min(tl[r].x, j);
+                tl[r].y = std::min(tl[r].y, i);
+                br[r].x = std::max(br[r].x, j);
+                br[r].y = std::max(br[r].y, i);
+
+                if (i != 0 && j != 0) {
+                    for (const int32_t other :{p[j - 1], previous_p[j], previous_p[j - 1]}) {
+                        if (other != r)
+                            edges.emplace_back(std::min(r, other), std::max(r, other));
+                    }
+                }
+            }
+            previous_p = p;
+        }
+
+        features.bounding_rects.resize(nb_segs);
+        for (int r = 0; r < nb_segs; ++r)
+            features.bounding_rects[r] = (br[r].x < 0) ? cv::Rect() : cv::Rect(tl[r], br[r] + cv::Point(1, 1));
+
+        // CSR adjacency - for every region the neighbors with a larger index in ascending order
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        features.neighbor_offsets.assign(nb_segs + 1, 0);
+        features.neighbors.resize(edges.size());
+        for (const std::pair<int32_t, int32_t> & e : edges)
+            ++features.neighbor_offsets[e.first + 1];
+        for (int r = 0; r < nb_segs; ++r)
+            features.neighbor_offsets[r + 1] += features.neighbor_offsets[r];
+        for (unsigned int e = 0; e < edges.size(); ++e)
+            features.neighbors[e] = edges[e].second; // edges are sorted, so already grouped by region
+
+        // Color histograms
+        std::vector<cv::Mat> planes;
+        cv::split(img, planes);
+        computeRegionHistograms(planes, img_regions, nb_segs, 25, features.color_hists);
+
+        // Texture histograms - positive/negative derivatives in 4 directions per channel
+        const cv::Mat diagonal1 = (cv::Mat_<float>(3, 3) << 0, 3, 10, -3, 0, 3, -10, -3, 0);
+        const cv::Mat diagonal2 = (cv::Mat_<float>(3, 3) << -10, -3, 0, -3, 0, 3, 0, 3, 10);
+
+        std::vector<cv::Mat> derivatives;
+        for (const cv::Mat & plane : planes) {
+            cv::Mat derivative;
+            cv::Scharr(plane, derivative, CV_32F, 1, 0);
+            addDerivativeParts(derivative, derivatives);
+            cv::Scharr(plane, derivative, CV_32F, 0, 1);
+            addDerivativeParts(derivative, derivatives);
+            cv::filter2D(plane, derivative, CV_32F, diagonal1);
+            addDerivativeParts(derivative, derivatives);
+            cv::filter2D(plane, derivative, CV_32F, diagonal2);
+            addDerivativeParts(derivative, derivatives);
+        }
+        computeRegionHistograms(derivatives, img_regions, nb_segs, 10, features.texture_hists);
+    }
+
+    // Strategies used for each segmentation [color+fill+texture+size, fill+texture+size, fill, size]
+
+    const std::vector<StrategyWeights> & getSelectiveSearchQualityStrategies(void) {
+        static const std::vector<StrategyWeights> strategies = {
+            {0.25f, 0.25f, 0.25f, 0.25f},
+            {0.f, 1.f / 3, 1.f / 3, 1.f / 3},
+            {0.f, 1.f, 0.f, 0.f},
+            {0.f, 0.f, 0.f, 1.f}
+        };
+        return strategies;
+    }
+
+    void getSelectiveSearchQualityImages(const cv::Mat & base_image, std::vector<cv::Mat> & images) {
+        images.clear();
+        images.reserve(5);
 
         cv::Mat hsv;
         cv::cvtColor(base_image, hsv, cv::COLOR_BGR2HSV);
-        m_images.push_back(hsv);
+        images.push_back(hsv);
 
         cv::Mat lab;
         cv::cvtColor(base_image, lab, cv::COLOR_BGR2Lab);
-        m_images.push_back(lab);
+        images.push_back(lab);
 
         cv::Mat I;
         cv::cvtColor(base_image, I, cv::COLOR_BGR2GRAY);
-        m_images.push_back(I);
+        images.push_back(I);
 
         cv::Mat channel[3];
         cv::split(hsv, channel);
-        m_images.push_back(channel[0]);
+        images.push_back(channel[0]);
 
         cv::split(base_image, channel);
         std::vector<cv::Mat> channel2 = {channel[2], channel[1], I};
 
         cv::Mat rgI;
         cv::merge(channel2, rgI);
-        m_images.push_back(rgI);
-
-
-        for (int k = base_k; k <= base_k + inc_k * 4; k += inc_k)
-            m_segmentations.emplace_back(cv::ximgproc::segmentation::createGraphSegmentation(sigma, float(k)));
-
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategyColor> color = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyColor();
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategyFill> fill = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyFill();
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategyTexture> texture = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyTexture();
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategySize> size = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategySize();
-        m_strategies.emplace_back(cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyMultiple(color, fill, texture, size));
-
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategyFill> fill2 = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyFill();
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategyTexture> texture2 = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyTexture();
-        cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategySize> size2 = cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategySize();
-        m_strategies.emplace_back(cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyMultiple(fill2, texture2, size2));
-
-        m_strategies.emplace_back(cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategyFill()); //fill3
-
-        m_strategies.emplace_back(cv::ximgproc::segmentation::createSelectiveSearchSegmentationStrategySize()); //size3
+        images.push_back(rgI);
     }
 
-    void hierarchicalGrouping(const cv::Mat & img, cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategy> & s, const cv::Mat & img_regions, const cv::Mat_<uint8_t> & is_neighbor, const cv::Mat_<int32_t> & sizes_, const std::vector<cv::Rect> & bounding_rects, std::vector<Region> & regions, int image_id) {
-        cv::Mat sizes = sizes_.clone();
+    void hierarchicalGrouping(const SegmentationFeatures & features, const StrategyWeights & strategy, std::vector<Region> & regions, cv::RNG & rng) {
+        GroupingState s(features, strategy);
         std::vector<Neighbor> similarities;
         regions.clear();
 
-        /////////////////////////////////////////
-        s->setImage(img, img_regions, sizes, image_id);
-
         // Compute initial similarities
-        regions.resize(bounding_rects.size());
-        for (unsigned int i = 0; i < bounding_rects.size(); ++i) {
+        const unsigned int nb_segs = features.bounding_rects.size();
+        regions.resize(nb_segs);
+        for (unsigned int i = 0; i < nb_segs; ++i) {
             regions[i].id = i;
             regions[i].level = 1;
             regions[i].merged_to = -1;
-            regions[i].bounding_box = bounding_rects[i];
+            regions[i].bounding_box = features.bounding_rects[i];
 
-            for (unsigned int j = i + 1; j < bounding_rects.size(); ++j) {
-                if (is_neighbor.at<uint8_t>(i, j)) {
-                    Neighbor n;
-                    n.from = i;
-                    n.to = j;
-                    n.similarity = s->get(i, j);
+            for (int e = features.neighbor_offsets[i]; e < features.neighbor_offsets[i + 1]; ++e) {
+                Neighbor n;
+                n.from = i;
+                n.to = features.neighbors[e];
+                n.similarity = s.get(n.from, n.to);
 
-                    similarities.push_back(n);
-                }
+                similarities.push_back(n);
             }
         }
 
-        while (similarities.size() != 0) {
-            std::sort(similarities.begin(), similarities.end());
+        // Adjacency lists between regions (indices into regions) - entries of merged regions are skipped lazily
+        std::vector< std::vector<int> > adjacency(regions.size());
+        for (const Neighbor & n : similarities) {
+            adjacency[n.from].push_back(n.to);
+            adjacency[n.to].push_back(n.from);
+        }
+
+        // Max-heap of similarities with lazy deletion - entries touching a merged region are discarded when popped
+        // Ties are broken by insertion order so the hierarchy is deterministic
+        std::vector<QueuedNeighbor> queue;
+        queue.reserve(similarities.size() * 2);
+        unsigned int sequence = 0;
+        for (const Neighbor & n : similarities)
+            queue.push_back(QueuedNeighbor{n, sequence++});
+        std::make_heap(queue.begin(), queue.end());
 
-            //for (const Neighbor & s : similarities) std::cout << s << std::endl;
+        std::vector<unsigned int> neighbor_stamp(regions.size(), 0); // For de-duplicating neighbors of merged pair
+        unsigned int stamp = 0;
 
-            Neighbor p = similarities.back();
-            similarities.pop_back();
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end());
+            Neighbor p = queue.back().neighbor;
+            queue.pop_back();
+
+            if (regions[p.from].merged_to != -1 || regions[p.to].merged_to != -1)
+                continue; // Stale - one of the regions has already been merged
 
             Region region_from = regions[p.from], region_to = regions[p.to];
 
@@ -111,125 +309,95 @@ namespace SegmentationCV {
             new_r.bounding_box = region_from.bounding_box | region_to.bounding_box;
 
             regions.push_back(new_r);
+            const int new_idx = regions.size() - 1;
 
-            regions[p.from].merged_to = regions[p.to].merged_to = regions.size() - 1;
+            regions[p.from].merged_to = regions[p.to].merged_to = new_idx;
 
             // Merge
-            s->merge(region_from.id, region_to.id);
-
-            // Update size
-            sizes.at<int32_t>(region_from.id, 0) += sizes.at<int32_t>(region_to.id, 0);
-            sizes.at<int32_t>(region_to.id, 0) += sizes.at<int32_t>(region_from.id, 0);
+            s.merge(region_from.id, region_to.id); // Also updates sizes
 
+            // Neighbors of new region are the live neighbors of both merged regions
             std::vector<int32_t> local_neighbors;
-
-            for (std::vector<Neighbor>::iterator similarity = similarities.begin(); similarity != similarities.end();) {
-                if (similarity->from == p.from || similarity->to == p.from || similarity->from == p.to || similarity->to == p.to) {
-                    int from = 0;
-
-                    from = (similarity->from == p.from || similarity->from == p.to) ? similarity->to : similarity->from;
-
-                    bool already_neighbor = false;
-                    for (const int32_t & local_neighbor : local_neighbors) {
-                        if (local_neighbor == from) {
-                            already_neighbor = true;
-                            break;
-                        }
+            ++stamp;
+            neighbor_stamp.push_back(0);
+            for (const int merged : {p.from, p.to}) {
+                for (const int neighbor : adjacency[merged]) {
+                    if (regions[neighbor].merged_to == -1 && neighbor_stamp[neighbor] != stamp) {
+                        neighbor_stamp[neighbor] = stamp;
+                        local_neighbors.push_back(neighbor);
                     }
-
-                    if (!already_neighbor)
-                        local_neighbors.push_back(from);
-
-                    similarity = similarities.erase(similarity);
-                } else {
-                    ++similarity;
                 }
+                std::vector<int>().swap(adjacency[merged]); // Merged region is never used again
             }
 
+            adjacency.emplace_back(local_neighbors.begin(), local_neighbors.end());
             for (const int32_t & local_neighbor : local_neighbors) {
+                adjacency[local_neighbor].push_back(new_idx);
+
                 Neighbor n;
-                n.from = regions.size() - 1;
+                n.from = new_idx;
                 n.to = local_neighbor;
-                n.similarity = s->get(regions[n.from].id, regions[n.to].id);
+                n.similarity = s.get(regions[n.from].id, regions[n.to].id);
 
-                similarities.push_back(n);
+                queue.push_back(QueuedNeighbor{n, sequence++});
+                std::push_heap(queue.begin(), queue.end());
             }
         }
 
         // Compute region's rank
         for (Region & r : regions)
-            r.rank = (double(std::rand()) / RAND_MAX) * r.level; // Note: this is inverted from the paper, but we keep the lower region first so it's works
+            r.rank = rng.uniform(0., 1.) * r.level; // Note: this is inverted from the paper, but we keep the lower region first so it's works
     }
 
     void process(const cv::Mat & img, std::vector<cv::Rect> & rects, int base_k, int inc_k, float sigma) {
         rects.clear();
-#ifdef DEBUG_SEGMENTATION
-        debugDisp1.clear();
-        debugDisp2.clear();
-#endif
-
-        switchToSelectiveSearchQuality(img, base_k, inc_k, sigma);
-
-        std::vector<Region> all_regions;
-
-        int image_id = 0;
-
-        for (std::vector<cv::Mat>::const_iterator image = m_images.begin(); image != m_images.end(); ++image) {
-            for (std::vector< cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> >::iterator gs = m_segmentations.begin(); gs != m_segmentations.end(); ++gs) {
-
-                // Compute initial segmentation
-                cv::Mat img_regions;
-                (*gs)->processImage(*image, img_regions);
-
-                // Get number of regions
-                double min, max;
-                cv::minMaxLoc(img_regions, &min, &max);
-                const int nb_segs = int(max) + 1;
-
-                // Compute bounding rectangles and neighbors
-                std::vector<cv::Rect> bounding_rects(nb_segs);
-                std::vector< std::vector<cv::Point> > points(nb_segs);
 
-                cv::Mat_<uint8_t> is_neighbor(cv::Mat::zeros(nb_segs, nb_segs, CV_8UC1));
-                cv::Mat_<int32_t> sizes(cv::Mat::zeros(nb_segs, 1, CV_32SC1));
-
-                const int * previous_p, * p;
-                for (int i = 0; i < img_regions.rows; ++i) {
-                    p = img_regions.ptr<int32_t>(i);
-
-                    for (int j = 0; j < img_regions.cols; ++j) {
-                        points[p[j]].push_back(cv::Point(j, i));
-                        ++sizes.at<int32_t>(p[j], 0);
-
-                        if (i != 0 && j != 0) {
-                            is_neighbor.at<uint8_t>(p[j], p[j - 1]) = is_neighbor.at<uint8_t>(p[j], previous_p[j]) = is_neighbor.at<uint8_t>(p[j], previous_p[j - 1]) = 1;
-
-                            is_neighbor.at<uint8_t>(p[j - 1], p[j]) = is_neighbor.at<uint8_t>(previous_p[j], p[j]) = is_neighbor.at<uint8_t>(previous_p[j - 1], p[j]) = 1;
-                        }
-                    }
-                    previous_p = p;
-                }
+        std::vector<cv::Mat> images;
+        getSelectiveSearchQualityImages(img, images);
 
-                for (int seg = 0; seg < nb_segs; ++seg)
-                    bounding_rects[seg] = cv::boundingRect(points[seg]);
+        std::vector<int> k_values;
+        for (int k = base_k; k <= base_k + inc_k * 4; k += inc_k)
+            k_values.push_back(k);
+
+        const std::vector<StrategyWeights> & strategies = getSelectiveSearchQualityStrategies();
+        const int nb_segmentations = images.size() * k_values.size();
+
+        // Segment every image/k combination and compute its features once - shared by all strategies
+        std::vector<cv::Mat> img_regions(nb_segmentations);
+        std::vector<SegmentationFeatures> features(nb_segmentations);
+        cv::parallel_for_(cv::Range(0, nb_segmentations), [&](const cv::Range & range) {
+            for (int seg = range.start; seg < range.end; ++seg) {
+                const cv::Mat & image = images[seg / k_values.size()];
+                cv::Ptr<cv::ximgproc::segmentation::GraphSegmentation> gs = cv::ximgproc::segmentation::createGraphSegmentation(sigma, float(k_values[seg % k_values.size()]));
+                gs->processImage(image, img_regions[seg]);
+                computeFeatures(image, img_regions[seg], features[seg]);
+            }
+        });
+
+        // Run grouping of all segmentation/strategy combinations - each has its own state
+        std::vector< std::vector<Region> > groupings(nb_segmentations * strategies.size());
+        cv::parallel_for_(cv::Range(0, int(groupings.size())), [&](const cv::Range & range) {
+            for (int g = range.start; g < range.end; ++g) {
+                cv::RNG rng(g + 1);
+                hierarchicalGrouping(features[g / strategies.size()], strategies[g % strategies.size()], groupings[g], rng);
+            }
+        });
 
 #ifdef DEBUG_SEGMENTATION
-                debugDisp1.push_back(img_regions.clone());
-                debugDisp2.push_back(image->clone());
-                for (const cv::Rect & r : bounding_rects)
-                    cv::rectangle(debugDisp2.back(), r, cv::Scalar(0, 255, 0));
+        m_images = images;
+        debugDisp1.clear();
+        debugDisp2.clear();
+        for (int seg = 0; seg < nb_segmentations; ++seg) {
+            debugDisp1.push_back(img_regions[seg].clone());
+            debugDisp2.push_back(images[seg / k_values.size()].clone());
+            for (const cv::Rect & r : features[seg].bounding_rects)
+                cv::rectangle(debugDisp2.back(), r, cv::Scalar(0, 255, 0));
+        }
 #endif
 
-                for (cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentationStrategy> strategy : m_strategies) {
-                    std::vector<Region> regions;
-                    hierarchicalGrouping(*image, strategy, img_regions, is_neighbor, sizes, bounding_rects, regions, image_id);
-
-                    all_regions.insert(all_regions.end(), regions.begin(), regions.end());
-                }
-
-                ++image_id;
-            }
-        }
+        std::vector<Region> all_regions;
+        for (const std::vector<Region> & regions : groupings)
+            all_regions.insert(all_regions.end(), regions.begin(), regions.end());
 
         std::sort(all_regions.begin(), all_regions.end());
 
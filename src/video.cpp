@@ -17,10 +17,12 @@ int main(int argc, char * argv[]) {
     cv::Mat img;
     std::vector<cv::Rect> segmentation_regions;
     std::vector<float> segmentation_scores;
+    Segmentation::StreamState segmentation_stream; //for segmenting every frame while playing
 
     //for control of operations
     unsigned int key = '\0';
     bool pause = false;
+    bool stream_segmentation = false;
 
     do {
         if (key == 's') //stop and run segmentation
@@ -29,6 +31,10 @@ int main(int argc, char * argv[]) {
             pause = false;
         else if (key == 'n')
             video >> img;
+        else if (key == 't') { //toggle segmentation of every frame
+            stream_segmentation = !stream_segmentation;
+            segmentation_stream.reset();
+        }
         else if (key == 'w') {
             sprintf(save_name, save_file_format, save_count++);
             cv::imwrite(save_name, img, save_params);
@@ -39,6 +45,12 @@ int main(int argc, char * argv[]) {
             video >> img;
             if (img.empty())
                 break;
+
+            if (stream_segmentation) {
+                Segmentation::processStream(img, segmentation_regions, segmentation_scores, segmentation_stream);
+                Segmentation::showSegmentationResults(img, segmentation_regions, segmentation_scores);
+                std::cout << "Tiles changed: " << segmentation_stream.tiles_changed << "/" << segmentation_stream.tiles_total << " | reused/recomputed: " << segmentation_stream.getReuseRatio() << std::endl;
+            }
         } else {
             Segmentation::process(img, segmentation_regions, segmentation_scores);
             Segmentation::showSegmentationResults(img, segmentation_regions, segmentation_scores);
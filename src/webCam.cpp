@@ -2,10 +2,13 @@
 #include <opencv2/highgui.hpp>
 
 #include "yoloInterface.h"
+#include "asyncDetector.h"
 
 #include "functions.h"
 #include "segmentationCV.h"
 
+#include <mutex>
+
 cv::Mat getPredictionImg(YoloInterface &y, const cv::Mat &img) {
     cv::Mat disp_img = img.clone();
 
@@ -38,6 +41,17 @@ int main(int argc, char * argv[]) {
     bool pause = false;
     bool detect = false;
 
+    //pipelined detection - results lag camera by a few frames but capture loop never waits on network
+    std::unique_ptr<AsyncDetector> async_detector;
+    std::mutex async_mutex;
+    std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > async_predictions;
+    AsyncDetector::Callback async_callback = [&async_mutex, &async_predictions](const AsyncDetector::Result & r) {
+        if (!r.dropped) {
+            std::lock_guard<std::mutex> lock(async_mutex);
+            async_predictions = r.predictions;
+        }
+    };
+
 
     while (true) {
         if (!pause) {
@@ -48,7 +62,13 @@ int main(int argc, char * argv[]) {
                 break;
             }
 
-            DisplayImg((detect ? getPredictionImg(yolo, frame) : frame), "camera");
+            if (async_detector) {
+                async_detector->submit(frame.clone(), async_callback); //capture reuses frame buffer
+                std::lock_guard<std::mutex> lock(async_mutex);
+                DisplayImg(YoloInterface::getPredictionsDisplayable(frame, async_predictions), "camera");
+            } else {
+                DisplayImg((detect ? getPredictionImg(yolo, frame) : frame), "camera");
+            }
         }
 
         unsigned int keyPressed = cv::waitKey(1);
@@ -58,7 +78,16 @@ int main(int argc, char * argv[]) {
             pause = true;
         } else if (keyPressed == 'c') {
             pause = false;
+        } else if (keyPressed == 'a') { //toggle async detection
+            if (async_detector) {
+                async_detector.reset();
+            } else {
+                detect = false;
+                async_predictions.clear();
+                async_detector.reset(new AsyncDetector(yolo));
+            }
         } else if (keyPressed == 'd') {
+            async_detector.reset(); //yolo can only be used by one of them
             detect = true;
             if (pause)
                 DisplayImg(getPredictionImg(yolo, frame), "camera");
@@ -0,0 +1,165 @@
+#include "asyncDetector.h"
+
+#include <chrono>
+
+AsyncDetector::AsyncDetector(YoloInterface &yolo) : m_yolo(yolo), m_pending(nullptr), m_running(true), m_submitted(0), m_dropped(0), m_completed(0) {
+    resize_batch_network(m_yolo.m_net, 1);
+    m_net_view = *m_yolo.m_net;
+
+    for (unsigned int i = 0; i < NUM_SLOTS; ++i) {
+        m_slots[i].input.resize(m_yolo.m_net->inputs);
+        m_slots[i].outputs.resize(detection_outputs_size(m_yolo.m_net));
+        m_free.push(i);
+    }
+
+    m_preprocess_thread = std::thread(&AsyncDetector::preprocessLoop, this);
+    m_forward_thread = std::thread(&AsyncDetector::forwardLoop, this);
+    m_postprocess_thread = std::thread(&AsyncDetector::postprocessLoop, this);
+}
+
+AsyncDetector::~AsyncDetector(void) {
+    m_running.store(false);
+    m_preprocess_thread.join();
+    m_forward_thread.join();
+    m_postprocess_thread.join();
+
+    //complete everything still in flight so no future is left waiting
+    std::unique_ptr<Job> job(m_pending.exchange(nullptr));
+    if (job)
+        drop(job);
+    for (Slot &s : m_slots) {
+        if (s.job)
+            drop(s.job);
+    }
+}
+
+std::future<AsyncDetector::Result> AsyncDetector::submit(const cv::Mat &frame, Callback callback) {
+    CV_Assert(frame.type() == CV_8UC3);
+
+    Job *job = new Job;
+    job->frame_id = m_submitted++;
+    job->frame = frame;
+    job->callback = std::move(callback);
+    std::future<Result> result = job->promise.get_future();
+
+    //replace waiting frame (if any) - it is stale now
+    std::unique_ptr<Job> replaced(m_pending.exchange(job));
+    if (replaced)
+        drop(replaced);
+
+    return result;
+}
+
+unsigned long AsyncDetector::getFramesSubmitted(void) const {
+    return m_submitted.load();
+}
+
+unsigned long AsyncDetector::getFramesDropped(void) const {
+    return m_dropped.load();
+}
+
+unsigned long AsyncDetector::getFramesCompleted(void) const {
+    return m_completed.load();
+}
+
+void AsyncDetector::preprocessLoop(void) {
+    unsigned int slot, spins = 0;
+    while (m_running.load()) {
+        //wait for a free slot first - newer frames keep replacing the pending one meanwhile
+        if (!m_free.pop(slot)) {
+            backoff(spins);
+            continue;
+        }
+
+        Job *pending;
+        while ((pending = m_pending.exchange(nullptr)) == nullptr && m_running.load())
+            backoff(spins);
+        std::unique_ptr<Job> job(pending);
+        if (!job)
+            break; //shutting down - keep slot, only postprocess thread may push to m_free
+        spins = 0;
+
+        Slot &s = m_slots[slot];
+        letterbox_bgr8_into(job->frame.data, job->frame.cols, job->frame.rows, job->frame.step, m_net_view.w, m_net_view.h, s.input.data());
+        s.job = std::move(job);
+
+        m_to_forward.push(slot); //never full - only NUM_SLOTS slots exist
+    }
+}
+
+void AsyncDetector::forwardLoop(void) {
+    unsigned int slot, spins = 0;
+    while (m_running.load()) {
+        if (!m_to_forward.pop(slot)) {
+            backoff(spins);
+            continue;
+        }
+        spins = 0;
+
+        Slot &s = m_slots[slot];
+        network_predict(m_yolo.m_net, s.input.data());
+        save_detection_outputs(m_yolo.m_net, s.outputs.data()); //network is free for next frame after this
+
+        m_to_postprocess.push(slot);
+    }
+}
+
+void AsyncDetector::postprocessLoop(void) {
+    unsigned int slot, spins = 0;
+    Result result;
+    std::vector<YoloInterface::Detection> detections;
+    while (m_running.load()) {
+        if (!m_to_postprocess.pop(slot)) {
+            backoff(spins);
+            continue;
+        }
+        spins = 0;
+
+        Slot &s = m_slots[slot];
+        const int img_w = s.job->frame.cols, img_h = s.job->frame.rows;
+        if (m_yolo.m_raw_decode) {
+            const unsigned int count = m_yolo.decodeCandidates(m_net_view, 0, s.outputs.data(), img_w, img_h, m_candidates);
+            m_yolo.convertCandidates(m_candidates.data(), count, img_w, img_h, detections, m_nms);
+        } else {
+            int nboxes = 0;
+            detection *dets = get_network_boxes_saved(&m_net_view, s.outputs.data(), img_w, img_h, m_yolo.m_thresh, m_yolo.m_thresh_hier, 0, 1, &nboxes);
+            m_yolo.convertDetections(dets, nboxes, img_w, img_h, detections, m_nms);
+            free_detections(dets, nboxes);
+        }
+        m_yolo.toPredictions(detections, result.predictions);
+
+        std::unique_ptr<Job> job = std::move(s.job);
+        m_free.push(slot); //slot can take next frame while callback runs
+
+        finish(job, result);
+    }
+}
+
+void AsyncDetector::finish(std::unique_ptr<Job> &job, Result &result) {
+    result.frame_id = job->frame_id;
+    result.dropped = false;
+    if (job->callback)
+        job->callback(result);
+    job->promise.set_value(std::move(result));
+    ++m_completed;
+    job.reset();
+}
+
+void AsyncDetector::drop(std::unique_ptr<Job> &job) {
+    Result result;
+    result.frame_id = job->frame_id;
+    result.dropped = true;
+    if (job->callback)
+        job->callback(result);
+    job->promise.set_value(std::move(result));
+    ++m_dropped;
+    job.reset();
+}
+
+void AsyncDetector::backoff(unsigned int &spins) {
+    //spin briefly for low latency when busy, then sleep so idle stages do not burn a core
+    if (++spins < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
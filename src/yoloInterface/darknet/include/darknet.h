@@ -138,6 +138,16 @@ struct layer{
     int n;
     int max_boxes;
     int groups;
+    int winograd_tile; /* output tile of 3x3 winograd path: 2 = F(2,3), 4 = F(4,3), 0 = im2col */
+    int direct; /* cpu forward by direct convolution - no im2col workspace */
+    int half_weights; /* weights, winograd_weights & direct_weights hold fp16 (unsigned short) - inference only */
+    int batchnorm_folded; /* batchnorm is folded into weights & biases (fold_batchnorm_convolutional_layer) */
+    int int8; /* cpu inference with int8 weights & input (see int8_convolution.c) */
+    float int8_range; /* calibration: largest |input| seen - input quantization scale is int8_range/127 */
+    int blocked; /* NCHW16c input / output - BLOCKED_INPUT | BLOCKED_OUTPUT bits (blocked_layout.h) */
+    int view_only; /* upsample: output is never written, its reader gets it through upsample_src (memory_plan.c) */
+    float *upsample_src; /* 1x1 convolution: input channels [upsample_c0, upsample_c0 + upsample_c) are upsample_stride */
+    int upsample_c0, upsample_c, upsample_stride; /* x nearest neighbour upsample of upsample_src, read as packed */
     int size;
     int side;
     int stride;
@@ -237,6 +247,13 @@ struct layer{
 
     float * weights;
     float * weight_updates;
+    float * winograd_weights; /* weights in winograd domain, alpha*alpha matrices n x c packed by gemm_pack_a */
+    float * direct_weights; /* weights of direct path: blocks of 16 filters, filter index fastest */
+    signed char * int8_weights; /* weights quantized per filter, packed in 6 row panels of 4 consecutive k */
+    float * int8_scales; /* per filter: weights = int8_scales*int8_weights */
+    int * int8_sums; /* per filter sum of int8_weights */
+    unsigned long long * xnor_weights; /* xnor: sign bits of every filter, 64 per word (xnor_convolution.c) */
+    float * xnor_scales; /* xnor: mean |weight| of every filter */
 
     float * delta;
     float * output;
@@ -481,10 +498,23 @@ typedef struct network{
     float *truth;
     float *delta;
     float *workspace;
+    size_t workspace_size; /* bytes allocated for workspace on cpu */
     int train;
     int index;
     float *cost;
     float clip;
+    int yolo_raw; /* inference: yolo layers skip logistic - outputs are read with decode_yolo_candidates */
+    int winograd; /* default output tile of 3x3 stride 1 convolutions: 4 = F(4,3), 2 = F(2,3), 0 = im2col (default 4 for inference networks, else 0) */
+    int direct; /* default for convolutions without winograd: 1 = direct convolution, 0 = im2col (default 1 for inference networks, else 0) */
+    int fold_batchnorm; /* load_weights folds batchnorm into convolution weights - inference only */
+    int half_weights; /* load_weights stores convolution weights as fp16 - inference only */
+    int blocked_layout; /* NCHW16c activations (block_network_layout) - inference only, experimental */
+    int inference; /* built without training buffers (parse_network_cfg_custom) - can not train */
+    float *activation_arena; /* plan_network_memory: every layer output lies in here, in slots shared over time */
+    size_t activation_arena_size;
+    int int8; /* quantized convolutions run int8 - 0 runs them in fp32 again */
+    int int8_calibrate; /* forward records largest |input| of every convolution in int8_range */
+    double *layer_time; /* profile_network: seconds spent in forward of each layer, summed - [n] counts forward passes */
 
 #ifdef GPU
     float *input_gpu;
@@ -525,6 +555,21 @@ typedef struct detection{
     int sort_class;
 } detection;
 
+/* one (box, class) pair above threshold - compact alternative to detection for yolo layers */
+typedef struct yolo_candidate{
+    box bbox;
+    float prob;
+    int class_id;
+} yolo_candidate;
+
+/* reusable storage for boxes of get_network_boxes_pool - zero initialize */
+typedef struct detection_pool{
+    detection *dets;
+    float *prob;
+    float *mask;
+    int size;
+} detection_pool;
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -585,6 +630,7 @@ typedef struct{
 
 
 network *load_network(char *cfg, char *weights, int clear);
+network *load_network_custom(char *cfg, char *weights, int clear, int inference);
 load_args get_base_args(network *net);
 
 void free_data(data d);
@@ -667,6 +713,8 @@ image make_random_image(int w, int h, int c);
 
 void denormalize_connected_layer(layer l);
 void denormalize_convolutional_layer(layer l);
+void fold_batchnorm_convolutional_layer(layer *l);
+void half_convolutional_weights(layer *l);
 void statistics_connected_layer(layer l);
 void rescale_weights(layer l, float scale, float trans);
 void rgbgr_weights(layer l);
@@ -680,6 +728,8 @@ int option_find_int(list *l, char *key, int def);
 int option_find_int_quiet(list *l, char *key, int def);
 
 network *parse_network_cfg(char *filename);
+network *parse_network_cfg_custom(char *filename, int inference);
+size_t plan_network_memory(network *net);
 void save_weights(network *net, char *filename);
 void load_weights(network *net, char *filename);
 void save_weights_upto(network *net, char *filename, int cutoff);
@@ -688,8 +738,10 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff);
 void zero_objectness(layer l);
 void get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, detection *dets);
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets);
+int decode_yolo_candidates(layer l, float *output, int w, int h, int netw, int neth, float thresh, int relative, const int *class_ids, int n_class_ids, yolo_candidate *cands, int capacity);
 void free_network(network *net);
 void set_batch_network(network *net, int b);
+void resize_batch_network(network *net, int b);
 void set_temp_network(network *net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
@@ -697,6 +749,7 @@ image make_image(int w, int h, int c);
 image resize_image(image im, int w, int h);
 void censor_image(image im, int dx, int dy, int w, int h);
 image letterbox_image(image im, int w, int h);
+void letterbox_bgr8_into(unsigned char *bgr, int w, int h, int step, int net_w, int net_h, float *dst);
 image crop_image(image im, int dx, int dy, int w, int h);
 image center_crop_image(image im, int w, int h);
 image resize_min(image im, int min);
@@ -744,6 +797,30 @@ int network_height(network *net);
 float *network_predict_image(network *net, image im);
 void network_detect(network *net, image im, float thresh, float hier_thresh, float nms, detection *dets);
 detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+detection *get_network_boxes_batch(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+int num_detections_batch(network *net, float thresh, int b);
+int detection_outputs_size(network *net);
+void save_detection_outputs(network *net, float *dst);
+detection *get_network_boxes_saved(network *net, float *saved, int w, int h, float thresh, float hier, int *map, int relative, int *num);
+detection *get_network_boxes_pool(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num, detection_pool *pool);
+void free_detection_pool(detection_pool *pool);
+void benchmark_gemm_network(network *net, int iterations);
+void benchmark_winograd_network(network *net, int iterations);
+void benchmark_direct_network(network *net, int iterations);
+int tune_convolution_network(network *net, char *cfgfile, char *plan_file);
+int block_network_layout(network *net);
+int quantize_int8_network(network *net);
+void save_int8_calibration(network *net, char *filename);
+int load_int8_calibration(network *net, char *filename);
+int int8_set_kernel(const char *name);
+const char *int8_kernel_name(void);
+void benchmark_int8_network(network *net, int iterations);
+int xnor_set_kernel(const char *name);
+const char *xnor_kernel_name(void);
+void benchmark_xnor_network(network *net, int iterations);
+void profile_network(network *net, int enable);
+void print_network_profile(network *net, FILE *fp);
+int save_network_profile(network *net, char *filename);
 void free_detections(detection *dets, int n);
 
 void reset_network_state(network *net, int b);
@@ -83,5 +83,16 @@ static inline float leaky_gradient(float x){return (x>0) ? 1 : .1;}
 static inline float tanh_gradient(float x){return 1-x*x;}
 static inline float plse_gradient(float x){return (x < 0 || x > 1) ? .01 : .125;}
 
+/* activate() for fused convolution epilogues - the cheap common cases stay inline */
+static inline float activate_inline(float x, ACTIVATION a)
+{
+    switch(a){
+        case LINEAR: return x;
+        case LEAKY: return leaky_activate(x);
+        case RELU: return relu_activate(x);
+        default: return activate(x, a);
+    }
+}
+
 #endif
 
@@ -6,6 +6,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLAS_F16C
+#endif
 void reorg_cpu(float *x, int w, int h, int c, int batch, int stride, int forward, float *out)
 {
     int b,i,j,k;
@@ -349,3 +354,102 @@ void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int for
 }
 
 
+
+/* IEEE fp16 <-> fp32, round to nearest even - portable fallback of the F16C loops below */
+static unsigned short float_to_half(float f)
+{
+    unsigned int x;
+    memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x >> 16) & 0x8000;
+    unsigned int absx = x & 0x7fffffff;
+    unsigned int h, rem, half;
+    if(absx >= 0x7f800000) return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+    if(absx >= 0x477ff000) return sign | 0x7c00;
+    if(absx < 0x38800000){
+        /* subnormal: h = m*2^(e-126) in units of 2^-24 */
+        if(absx < 0x33000000) return sign;
+        unsigned int m = (absx & 0x7fffff) | 0x800000;
+        unsigned int shift = 126 - (absx >> 23);
+        h = m >> shift;
+        rem = m & ((1u << shift) - 1);
+        half = 1u << (shift - 1);
+    } else {
+        h = (absx - 0x38000000) >> 13;
+        rem = absx & 0x1fff;
+        half = 0x1000;
+    }
+    if(rem > half || (rem == half && (h & 1))) ++h;
+    return sign | h;
+}
+
+static float half_to_float(unsigned short h)
+{
+    unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    unsigned int e = (h >> 10) & 0x1f;
+    unsigned int m = h & 0x3ff;
+    unsigned int x;
+    float f;
+    if(e == 0x1f){
+        x = sign | 0x7f800000 | (m << 13);
+    } else if(e){
+        x = sign | ((e + 112) << 23) | (m << 13);
+    } else if(!m){
+        x = sign;
+    } else {
+        e = 113;
+        while(!(m & 0x400)){
+            m <<= 1;
+            --e;
+        }
+        x = sign | (e << 23) | ((m & 0x3ff) << 13);
+    }
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#ifdef BLAS_F16C
+__attribute__((target("avx,f16c")))
+static void float_to_half_f16c(const float *x, size_t n, unsigned short *y)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        _mm_storeu_si128((__m128i *)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for(; i < n; ++i) y[i] = float_to_half(x[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void half_to_float_f16c(const unsigned short *x, size_t n, float *y)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i))));
+    }
+    for(; i < n; ++i) y[i] = half_to_float(x[i]);
+}
+#endif
+
+void float_to_half_cpu(const float *x, size_t n, unsigned short *y)
+{
+    size_t i;
+#ifdef BLAS_F16C
+    if(__builtin_cpu_supports("f16c")){
+        float_to_half_f16c(x, n, y);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) y[i] = float_to_half(x[i]);
+}
+
+/* serial - called per panel from inside parallel loops */
+void half_to_float_cpu(const unsigned short *x, size_t n, float *y)
+{
+    size_t i;
+#ifdef BLAS_F16C
+    if(__builtin_cpu_supports("f16c")){
+        half_to_float_f16c(x, n, y);
+        return;
+    }
+#endif
+    for(i = 0; i < n; ++i) y[i] = half_to_float(x[i]);
+}
@@ -43,6 +43,8 @@ void weighted_delta_cpu(float *a, float *b, float *s, float *da, float *db, floa
 void softmax(float *input, int n, float temp, int stride, float *output);
 void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output);
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out);
+void float_to_half_cpu(const float *x, size_t n, unsigned short *y);
+void half_to_float_cpu(const unsigned short *x, size_t n, float *y);
 
 #ifdef GPU
 #include "cuda.h"
@@ -0,0 +1,102 @@
+#include "blocked_layout.h"
+#include "direct_convolution.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* NCHW16c layout for cpu inference: activations are stored as [channel / 16][y][x][16], so the 16 channels of a pixel
+   are one contiguous vector. convolutions run direct (one simd lane per filter, stored straight into an output
+   pixel vector), maxpool & upsample move whole pixel vectors, route & shortcut are unchanged (route concatenates
+   whole channel blocks, shortcut adds equally shaped tensors elementwise in any layout).
+   conversion happens once at each end: the first convolution reads the NCHW network input, the convolutions
+   feeding yolo layers (& the network output) write NCHW - yolo layers & everything after forward see plain tensors.
+
+   all or nothing: every layer must be convolutional (groups 1, not binary / xnor, 1x1 only with stride 1), maxpool, route, shortcut (equal shapes), upsample (not reverse) or yolo, and every blocked tensor must
+   have a multiple of 16 channels. */
+
+static int blocked_supported(layer l)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+            if(l.size == 1 && l.stride != 1) return 0;
+            return l.groups == 1 && !l.binary && !l.xnor && !l.half_weights && !l.int8;
+        case SHORTCUT:
+            return l.w == l.out_w && l.h == l.out_h && l.c == l.out_c;
+        case UPSAMPLE:
+            return !l.reverse;
+        case MAXPOOL:
+        case ROUTE:
+        case YOLO:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* which layer outputs are NCHW16c - 0 if the network can not run blocked */
+static int blocked_outputs(network *net, int *blocked)
+{
+    int i, j;
+    const layer out = get_network_output_layer(net);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!blocked_supported(l)) return 0;
+        /* yolo heads & the network output are where NCHW comes back */
+        int head = l.output == out.output || (i + 1 < net->n && net->layers[i+1].type == YOLO);
+        blocked[i] = l.type != YOLO && !head;
+        if(blocked[i] && l.out_c % BLOCKED_C) return 0;
+        if(head && l.type != CONVOLUTIONAL && l.type != YOLO) return 0;
+    }
+    if(net->layers[0].type != CONVOLUTIONAL) return 0;
+    /* every reader of a tensor must take it in the layout it is stored in - only convolutions read either */
+    for(i = 1; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j){
+                if(!blocked[l.input_layers[j]]) return 0;
+            }
+        } else if(l.type == YOLO){
+            if(blocked[i-1]) return 0;
+        } else if(l.type != CONVOLUTIONAL){
+            if(!blocked[i-1]) return 0;
+            if(l.type == SHORTCUT && !blocked[l.index]) return 0;
+        }
+    }
+    return 1;
+}
+
+/* switches an inference network (parse_network_cfg_custom) to NCHW16c activations - call before load_weights, the
+   direct weights of every convolution are built & batchnorm is folded into them as they load. returns the number of blocked layers, 0 if the
+   network can not run blocked (it is then left as it was) */
+int block_network_layout(network *net)
+{
+    int i, count = 0;
+    size_t workspace_size = 0;
+    if(!net->inference) return 0;
+#ifdef GPU
+    if(gpu_index >= 0) return 0;
+#endif
+    int *blocked = calloc(net->n, sizeof(int));
+    if(!blocked_outputs(net, blocked)){
+        fprintf(stderr, "NCHW16c layout: network has layers or channel counts it does not support\n");
+        free(blocked);
+        return 0;
+    }
+    /* forward_batchnorm_layer works on NCHW */
+    net->fold_batchnorm = 1;
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        int in = i > 0 && blocked[i-1] ? BLOCKED_INPUT : 0;
+        int out = blocked[i] ? BLOCKED_OUTPUT : 0;
+        if(l->type == CONVOLUTIONAL) setup_blocked_convolution(l, in | out);
+        else if(l->type != YOLO) l->blocked = BLOCKED_INPUT | BLOCKED_OUTPUT;
+        count += l->blocked != 0;
+        if(l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+    }
+    free(net->workspace);
+    net->workspace = workspace_size ? calloc(1, workspace_size) : 0;
+    net->workspace_size = workspace_size;
+    fprintf(stderr, "NCHW16c layout (experimental, usually slower than the default layout): %d of %d layers blocked\n", count, net->n);
+    free(blocked);
+    return count;
+}
@@ -0,0 +1,10 @@
+#ifndef BLOCKED_LAYOUT_H
+#define BLOCKED_LAYOUT_H
+
+#include "darknet.h"
+
+#define BLOCKED_C 16 /* channels per block of NCHW16c - one avx512 vector, two avx2 vectors */
+#define BLOCKED_INPUT 1 /* layer.blocked bits */
+#define BLOCKED_OUTPUT 2
+
+#endif
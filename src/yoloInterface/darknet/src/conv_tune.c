@@ -0,0 +1,213 @@
+#include "convolutional_layer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Convolution algorithm autotuner: which of im2col + gemm, winograd F(2,3) / F(4,3) and direct convolution is fastest
+   depends on the layer shape and the cpu, so every convolution with more than one path it can run is timed on each
+   of them and keeps the fastest. the choice is saved as a plan whose first line is a key of cfg hash, input size,
+   batch, threads & cpu model - a later load with the same key reads the plan instead of timing again, any other
+   key times again & overwrites it. 1x1 layers only have the gemm path (they read their input in place), so they
+   are not part of the plan. */
+
+#define CONV_TUNE_ITERATIONS 3 /* timed runs per candidate after one warm up - fastest counts */
+
+typedef struct{
+    const char *name;
+    int winograd_tile;
+    int direct;
+} conv_algorithm;
+
+static const conv_algorithm conv_algorithms[] = {
+    {"im2col", 0, 0},
+    {"winograd2", 2, 0},
+    {"winograd4", 4, 0},
+    {"direct", 0, 1},
+};
+#define CONV_ALGORITHMS (int)(sizeof(conv_algorithms)/sizeof(conv_algorithms[0]))
+
+static int conv_algorithm_of(layer l)
+{
+    int a;
+    for(a = 0; a < CONV_ALGORITHMS; ++a){
+        if(conv_algorithms[a].winograd_tile == l.winograd_tile && conv_algorithms[a].direct == l.direct) return a;
+    }
+    return 0;
+}
+
+static int conv_tunable(layer l)
+{
+    return l.type == CONVOLUTIONAL && l.size > 1 && !l.binary && !l.xnor && !l.blocked;
+}
+
+/* FNV-1a of the cfg file - any edit to it is a different network */
+static unsigned long long conv_tune_hash(char *filename)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    int ch;
+    FILE *fp = fopen(filename, "rb");
+    if(!fp) return 0;
+    while((ch = fgetc(fp)) != EOF){
+        h ^= (unsigned char)ch;
+        h *= 1099511628211ULL;
+    }
+    fclose(fp);
+    return h;
+}
+
+static void conv_tune_cpu(char *cpu, size_t size)
+{
+    char line[512];
+    strncpy(cpu, "unknown", size);
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    if(!fp) return;
+    while(fgets(line, sizeof(line), fp)){
+        char *v = strchr(line, ':');
+        if(strncmp(line, "model name", 10) || !v) continue;
+        v += 1 + strspn(v + 1, " \t");
+        v[strcspn(v, "\n")] = 0;
+        strncpy(cpu, v, size - 1);
+        cpu[size - 1] = 0;
+        break;
+    }
+    fclose(fp);
+}
+
+static void conv_tune_key(network *net, char *cfgfile, char *key, size_t size)
+{
+    char cpu[256];
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    conv_tune_cpu(cpu, sizeof(cpu));
+    snprintf(key, size, "conv_plan %016llx %dx%d batch %d threads %d %s", conv_tune_hash(cfgfile), net->w, net->h,
+            net->batch, threads, cpu);
+}
+
+/* workspace of net fitted to its layers again after algorithms changed */
+static void conv_tune_workspace(network *net, int shrink)
+{
+    size_t size = 0;
+    int i;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].workspace_size > size) size = net->layers[i].workspace_size;
+    }
+    if(size > net->workspace_size || (shrink && size < net->workspace_size)){
+        free(net->workspace);
+        net->workspace = size ? calloc(1, size) : 0;
+        net->workspace_size = size;
+    }
+}
+
+/* plan of key from filename applied to net - 0 if there is none or it does not fit net */
+static int conv_tune_load(network *net, char *filename, const char *key)
+{
+    char line[512];
+    int index, a, applied = 0, tunable = 0, i;
+    char name[64];
+    FILE *fp = fopen(filename, "r");
+    if(!fp) return 0;
+    if(!fgets(line, sizeof(line), fp) || strncmp(line, key, strlen(key)) || line[strlen(key)] != '\n'){
+        fclose(fp);
+        return 0;
+    }
+    while(fscanf(fp, "%d %63s", &index, name) == 2){
+        if(index < 0 || index >= net->n || !conv_tunable(net->layers[index])) break;
+        for(a = 0; a < CONV_ALGORITHMS && strcmp(name, conv_algorithms[a].name); ++a);
+        if(a == CONV_ALGORITHMS) break;
+        if(!set_convolutional_algorithm(&net->layers[index], conv_algorithms[a].winograd_tile,
+                    conv_algorithms[a].direct)) break;
+        ++applied;
+    }
+    fclose(fp);
+    for(i = 0; i < net->n; ++i) tunable += conv_tunable(net->layers[i]);
+    return applied == tunable;
+}
+
+static double conv_tune_time(layer *l, network state)
+{
+    int it;
+    double best = 0;
+    forward_convolutional_layer(*l, state);
+    for(it = 0; it < CONV_TUNE_ITERATIONS; ++it){
+        double t = what_time_is_it_now();
+        forward_convolutional_layer(*l, state);
+        t = what_time_is_it_now() - t;
+        if(it == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+/* every tunable convolution timed on each path it can run & left on the fastest - plan written to filename */
+static void conv_tune_run(network *net, char *filename, const char *key)
+{
+    int i, j, a;
+    double total_before = 0, total_after = 0;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) fprintf(stderr, "Couldn't write convolution plan %s\n", filename);
+    else fprintf(fp, "%s\n", key);
+    fprintf(stderr, "Tuning convolutions, %s\n", key);
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(!conv_tunable(*l)) continue;
+        network state = *net;
+        state.train = 0;
+        state.int8 = 0;
+        state.input = calloc((size_t)l->inputs*l->batch, sizeof(float));
+        for(j = 0; j < l->inputs*l->batch; ++j) state.input[j] = rand_uniform(-1, 1);
+
+        int configured = conv_algorithm_of(*l), best = -1;
+        double t_best = 0;
+        fprintf(stderr, "%5d conv %2d x%2d /%2d %4d x%4d x%4d -> %4d:", i, l->size, l->size, l->stride, l->w, l->h,
+                l->c, l->n);
+        for(a = 0; a < CONV_ALGORITHMS; ++a){
+            if(!set_convolutional_algorithm(l, conv_algorithms[a].winograd_tile, conv_algorithms[a].direct)) continue;
+            conv_tune_workspace(net, 0);
+            state.workspace = net->workspace;
+            double t = conv_tune_time(l, state);
+            fprintf(stderr, " %s %.2f ms", conv_algorithms[a].name, 1000*t);
+            if(a == configured) total_before += t;
+            if(best < 0 || t < t_best){
+                best = a;
+                t_best = t;
+            }
+        }
+        set_convolutional_algorithm(l, conv_algorithms[best].winograd_tile, conv_algorithms[best].direct);
+        total_after += t_best;
+        fprintf(stderr, " -> %s\n", conv_algorithms[best].name);
+        if(fp) fprintf(fp, "%d %s\n", i, conv_algorithms[best].name);
+        free(state.input);
+    }
+    if(fp) fclose(fp);
+    fprintf(stderr, "Tuned convolutions: %.1f ms with [net] algorithms -> %.1f ms\n", 1000*total_before,
+            1000*total_after);
+}
+
+/* picks the fastest cpu algorithm of every convolution: plan_file is read if it was made for the same cfg, input
+   size, batch, threads & cpu, else each candidate is timed & plan_file written. weights must still be fp32 (before
+   half_convolutional_weights) - tune before load_weights with half_weights set. returns 1 if a plan was loaded */
+int tune_convolution_network(network *net, char *cfgfile, char *plan_file)
+{
+    char key[512];
+    int i, loaded;
+#ifdef GPU
+    if(gpu_index >= 0) return 0;
+#endif
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type == CONVOLUTIONAL && net->layers[i].half_weights){
+            fprintf(stderr, "Can't tune convolutions with fp16 weights\n");
+            return 0;
+        }
+    }
+    conv_tune_key(net, cfgfile, key, sizeof(key));
+    loaded = conv_tune_load(net, plan_file, key);
+    if(loaded) fprintf(stderr, "Loaded convolution plan %s\n", plan_file);
+    else conv_tune_run(net, plan_file, key);
+    conv_tune_workspace(net, 1);
+    return loaded;
+}
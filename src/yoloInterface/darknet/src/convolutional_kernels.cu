@@ -274,8 +274,9 @@ void pull_convolutional_layer(layer l)
 {
     cuda_pull_array(l.weights_gpu, l.weights, l.nweights);
     cuda_pull_array(l.biases_gpu, l.biases, l.n);
-    cuda_pull_array(l.weight_updates_gpu, l.weight_updates, l.nweights);
-    cuda_pull_array(l.bias_updates_gpu, l.bias_updates, l.n);
+    /* inference only layers (make_convolutional_layer with train = 0) have no host update arrays */
+    if(l.weight_updates) cuda_pull_array(l.weight_updates_gpu, l.weight_updates, l.nweights);
+    if(l.bias_updates) cuda_pull_array(l.bias_updates_gpu, l.bias_updates, l.n);
     if (l.batch_normalize){
         cuda_pull_array(l.scales_gpu, l.scales, l.n);
         cuda_pull_array(l.rolling_mean_gpu, l.rolling_mean, l.n);
@@ -287,8 +288,9 @@ void push_convolutional_layer(layer l)
 {
     cuda_push_array(l.weights_gpu, l.weights, l.nweights);
     cuda_push_array(l.biases_gpu, l.biases, l.n);
-    cuda_push_array(l.weight_updates_gpu, l.weight_updates, l.nweights);
-    cuda_push_array(l.bias_updates_gpu, l.bias_updates, l.n);
+    /* inference only layers (make_convolutional_layer with train = 0) have no host update arrays */
+    if(l.weight_updates) cuda_push_array(l.weight_updates_gpu, l.weight_updates, l.nweights);
+    if(l.bias_updates) cuda_push_array(l.bias_updates_gpu, l.bias_updates, l.n);
     if (l.batch_normalize){
         cuda_push_array(l.scales_gpu, l.scales, l.n);
         cuda_push_array(l.rolling_mean_gpu, l.rolling_mean, l.n);
@@ -5,7 +5,13 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
+#include "direct_convolution.h"
+#include "int8_convolution.h"
+#include "xnor_convolution.h"
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
 
 #ifdef AI2
@@ -83,6 +89,12 @@ image get_convolutional_delta(convolutional_layer l)
     return float_to_image(l.out_w,l.out_h,l.out_c,l.delta);
 }
 
+/* im2col buffer - needed by every layer when training, since winograd & direct paths are inference only */
+size_t get_convolutional_train_workspace_size(layer l)
+{
+    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+}
+
 static size_t get_workspace_size(layer l){
 #ifdef CUDNN
     if(gpu_index >= 0){
@@ -115,7 +127,13 @@ static size_t get_workspace_size(layer l){
         return most;
     }
 #endif
-    return (size_t)l.out_h*l.out_w*l.size*l.size*l.c/l.groups*sizeof(float);
+    size_t s = l.direct ? 0 : get_convolutional_train_workspace_size(l);
+    size_t winograd = get_winograd_workspace_size(l);
+    size_t int8 = get_int8_workspace_size(l);
+    size_t xnor = get_xnor_workspace_size(l);
+    if(winograd > s) s = winograd;
+    if(xnor > s) s = xnor;
+    return int8 > s ? int8 : s;
 }
 
 #ifdef GPU
@@ -173,7 +191,7 @@ void cudnn_convolutional_setup(layer *l)
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam)
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int train)
 {
     int i;
     convolutional_layer l = {0};
@@ -192,11 +210,13 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.pad = padding;
     l.batch_normalize = batch_normalize;
 
+    /* train = 0: inference only - no updates, deltas or batchnorm / adam training state */
     l.weights = calloc(c/groups*n*size*size, sizeof(float));
-    l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
-
     l.biases = calloc(n, sizeof(float));
-    l.bias_updates = calloc(n, sizeof(float));
+    if(train){
+        l.weight_updates = calloc(c/groups*n*size*size, sizeof(float));
+        l.bias_updates = calloc(n, sizeof(float));
+    }
 
     l.nweights = c/groups*n*size*size;
     l.nbiases = n;
@@ -216,7 +236,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.inputs = l.w * l.h * l.c;
 
     l.output = calloc(l.batch*l.outputs, sizeof(float));
-    l.delta  = calloc(l.batch*l.outputs, sizeof(float));
+    if(train) l.delta  = calloc(l.batch*l.outputs, sizeof(float));
 
     l.forward = forward_convolutional_layer;
     l.backward = backward_convolutional_layer;
@@ -233,7 +253,6 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 
     if(batch_normalize){
         l.scales = calloc(n, sizeof(float));
-        l.scale_updates = calloc(n, sizeof(float));
         for(i = 0; i < n; ++i){
             l.scales[i] = 1;
         }
@@ -241,15 +260,17 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
         l.mean = calloc(n, sizeof(float));
         l.variance = calloc(n, sizeof(float));
 
-        l.mean_delta = calloc(n, sizeof(float));
-        l.variance_delta = calloc(n, sizeof(float));
-
         l.rolling_mean = calloc(n, sizeof(float));
         l.rolling_variance = calloc(n, sizeof(float));
-        l.x = calloc(l.batch*l.outputs, sizeof(float));
-        l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        if(train){
+            l.scale_updates = calloc(n, sizeof(float));
+            l.mean_delta = calloc(n, sizeof(float));
+            l.variance_delta = calloc(n, sizeof(float));
+            l.x = calloc(l.batch*l.outputs, sizeof(float));
+            l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        }
     }
-    if(adam){
+    if(adam && train){
         l.m = calloc(l.nweights, sizeof(float));
         l.v = calloc(l.nweights, sizeof(float));
         l.bias_m = calloc(n, sizeof(float));
@@ -342,10 +363,77 @@ void denormalize_convolutional_layer(convolutional_layer l)
     }
 }
 
+/* inference only: bakes rolling mean / variance and scales into weights & biases (same epsilon as
+   forward_batchnorm_layer) so forward is gemm + bias + activation. layer no longer batch normalizes after this */
+void fold_batchnorm_convolutional_layer(convolutional_layer *l)
+{
+    int i, j;
+    int size = l->nweights/l->n;
+    if(!l->batch_normalize) return;
+    for(i = 0; i < l->n; ++i){
+        float scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+        for(j = 0; j < size; ++j){
+            l->weights[i*size + j] *= scale;
+        }
+        l->biases[i] -= l->rolling_mean[i] * scale;
+    }
+    l->batch_normalize = 0;
+    l->batchnorm_folded = 1;
+    transform_winograd_weights(*l);
+    transform_direct_weights(*l);
+    transform_xnor_weights(*l);
+#ifdef GPU
+    if(gpu_index >= 0){
+        push_convolutional_layer(*l);
+    }
+#endif
+}
+
+/* cpu inference path of l: winograd_tile 2 / 4, else direct = 1 for direct convolution, else im2col. returns 0 (and
+   leaves l on im2col or the nearest path it can run) if l can not run the one asked for. weights must be fp32 */
+int set_convolutional_algorithm(convolutional_layer *l, int winograd_tile, int direct)
+{
+    if(l->half_weights) return 0;
+    free(l->winograd_weights);
+    free(l->direct_weights);
+    l->winograd_weights = 0;
+    l->direct_weights = 0;
+    l->winograd_tile = 0;
+    l->direct = 0;
+    setup_winograd_convolution(l, winograd_tile);
+    setup_direct_convolution(l, !winograd_tile && direct);
+    l->workspace_size = get_workspace_size(*l);
+    return l->winograd_tile == winograd_tile && l->direct == (!winograd_tile && direct);
+}
+
+/* n floats of *w replaced by fp16 - *w then points at unsigned shorts */
+static void float_buffer_to_half(float **w, size_t n)
+{
+    unsigned short *h = calloc(n, sizeof(unsigned short));
+    float_to_half_cpu(*w, n, h);
+    free(*w);
+    *w = (float *)h;
+}
+
+/* inference only: weights and the winograd / direct copies made from them are stored as fp16 (halves their memory &
+   the bandwidth of reading them) and expanded back to fp32 as the gemm / direct kernels load them. must run after
+   the last change to weights (fold_batchnorm_convolutional_layer) - transforms & training need fp32 */
+void half_convolutional_weights(convolutional_layer *l)
+{
+    if(l->half_weights || l->binary || l->xnor) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    float_buffer_to_half(&l->weights, l->nweights);
+    if(l->winograd_tile) float_buffer_to_half(&l->winograd_weights, get_winograd_weights_size(*l));
+    if(l->direct) float_buffer_to_half(&l->direct_weights, get_direct_weights_size(*l));
+    l->half_weights = 1;
+}
+
 /*
 void test_convolutional_layer()
 {
-    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0);
+    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0, 1);
     l.batch_normalize = 1;
     float data[] = {1,1,1,1,1,
         1,1,1,1,1,
@@ -381,8 +469,8 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->inputs = l->w * l->h * l->c;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
+    if(l->delta) l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    if(l->batch_normalize && l->x){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
     }
@@ -445,10 +533,13 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
+    /* without batchnorm every path writes activation(conv + bias) as it stores its output, so there is no
+       zeroing, bias or activation pass over l.output. with batchnorm they write the raw convolution */
+    const int fused = !l.batch_normalize;
+    /* inference xnor layers run on packed sign bits (xnor_convolution.c) instead of binarized floats */
+    const int packed = l.xnor_weights && !net.train;
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
-
-    if(l.xnor){
+    if(l.xnor && !packed){
         binarize_weights(l.weights, l.n, l.c/l.groups*l.size*l.size, l.binary_weights);
         swap_binary(&l);
         binarize_cpu(net.input, l.c*l.h*l.w*l.batch, l.binary_input);
@@ -458,32 +549,115 @@ void forward_convolutional_layer(convolutional_layer l, network net)
     int m = l.n/l.groups;
     int k = l.size*l.size*l.c/l.groups;
     int n = l.out_w*l.out_h;
-    for(i = 0; i < l.batch; ++i){
-        for(j = 0; j < l.groups; ++j){
-            float *a = l.weights + j*l.nweights/l.groups;
-            float *b = net.workspace;
-            float *c = l.output + (i*l.groups + j)*n*m;
-            float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+    /* input channels the planner left as a view of an upsample input (memory_plan.c) */
+    gemm_upsample_rows up = {l.upsample_src, l.upsample_c0, l.upsample_c, l.upsample_stride, l.w, l.h};
+    const gemm_upsample_rows *view = l.upsample_src ? &up : 0;
+
+    if(packed){
+        forward_xnor_convolution(l, net);
+    } else if(l.int8 && net.int8 && !net.train){
+        if(view){
+            upsample_cpu(l.upsample_src, l.w/l.upsample_stride, l.h/l.upsample_stride, l.upsample_c, 1,
+                    l.upsample_stride, 1, 1, net.input + (size_t)l.upsample_c0*l.h*l.w);
+        }
+        forward_int8_convolution(l, net);
+    } else if(l.winograd_tile && !net.train){
+        forward_winograd_convolution(l, net);
+    } else if(l.direct && !net.train){
+        forward_direct_convolution(l, net);
+    } else {
+        for(i = 0; i < l.batch; ++i){
+            for(j = 0; j < l.groups; ++j){
+                float *b = net.workspace;
+                float *c = l.output + (i*l.groups + j)*n*m;
+                float *im =  net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
 
-            if (l.size == 1) {
-                b = im;
-            } else {
-                im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                if (l.size == 1) {
+                    b = im;
+                } else {
+                    im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+                }
+                if(l.half_weights){
+                    unsigned short *a = (unsigned short *)l.weights + j*l.nweights/l.groups;
+                    gemm_packed_half_bias_activate(m,n,k,a,k,b,n,c,n,fused ? l.biases + j*m : 0,fused ? l.activation : LINEAR,view);
+                } else if(fused || view){
+                    float *a = l.weights + j*l.nweights/l.groups;
+                    gemm_packed_bias_activate(0,0,m,n,k,1,a,k,b,n,c,n,fused ? l.biases + j*m : 0,fused ? l.activation : LINEAR,view);
+                } else {
+                    float *a = l.weights + j*l.nweights/l.groups;
+                    gemm(0,0,m,n,k,1,a,k,b,n,0,c,n);
+                }
             }
-            gemm(0,0,m,n,k,1,a,k,b,n,1,c,n);
         }
     }
 
     if(l.batch_normalize){
         forward_batchnorm_layer(l, net);
-    } else {
-        add_bias(l.output, l.biases, l.batch, l.n, l.out_h*l.out_w);
+        activate_array(l.output, l.outputs*l.batch, l.activation);
     }
-
-    activate_array(l.output, l.outputs*l.batch, l.activation);
     if(l.binary || l.xnor) swap_binary(&l);
 }
 
+/* times forward_convolutional_layer of ref (l with the path under test switched off) and of l on the same random
+   input in [-range, range], with a workspace big enough for either, & compares their outputs */
+conv_path_timing time_convolutional_paths(layer ref, layer l, network net, float range, int iterations)
+{
+    conv_path_timing t;
+    size_t workspace = get_convolutional_train_workspace_size(l);
+    int i, it;
+    if(l.workspace_size > workspace) workspace = l.workspace_size;
+    if(ref.workspace_size > workspace) workspace = ref.workspace_size;
+    if(iterations < 1) iterations = 1;
+    /* int8 is dispatched before every other path - keep it only when it is the path under test,
+       otherwise both runs would time the int8 kernel */
+    if(ref.int8 == l.int8) ref.int8 = l.int8 = 0;
+
+    net.train = 0;
+    net.input = calloc((size_t)l.inputs*l.batch, sizeof(float));
+    net.workspace = calloc(1, workspace);
+    for(i = 0; i < l.inputs*l.batch; ++i) net.input[i] = rand_uniform(-range, range);
+    float *out = calloc((size_t)l.outputs*l.batch, sizeof(float));
+
+    /* channels read through an upsample view (memory_plan.c) come from upsample_src, not net.input - give the view
+       its own random source & materialize it in net.input too, so every path sees the same values */
+    float *src = 0;
+    if(l.upsample_src){
+        const int sw = l.w/l.upsample_stride, sh = l.h/l.upsample_stride;
+        const size_t n = (size_t)l.upsample_c*sw*sh;
+        int b;
+        src = calloc(n*l.batch, sizeof(float));
+        for(i = 0; i < n*l.batch; ++i) src[i] = rand_uniform(-range, range);
+        for(b = 0; b < l.batch; ++b){
+            upsample_cpu(src + b*n, sw, sh, l.upsample_c, 1, l.upsample_stride, 1, 1,
+                    net.input + (size_t)b*l.inputs + (size_t)l.upsample_c0*l.h*l.w);
+        }
+        ref.upsample_src = l.upsample_src = src;
+    }
+
+    double start = what_time_is_it_now();
+    for(it = 0; it < iterations; ++it) forward_convolutional_layer(ref, net);
+    t.ref_time = (what_time_is_it_now() - start)/iterations;
+    memcpy(out, ref.output, (size_t)l.outputs*l.batch*sizeof(float));
+
+    start = what_time_is_it_now();
+    for(it = 0; it < iterations; ++it) forward_convolutional_layer(l, net);
+    t.time = (what_time_is_it_now() - start)/iterations;
+
+    float max_ref = 0, max_diff = 0;
+    for(i = 0; i < l.outputs*l.batch; ++i){
+        float d = fabs(l.output[i] - out[i]);
+        if(fabs(out[i]) > max_ref) max_ref = fabs(out[i]);
+        if(d > max_diff) max_diff = d;
+    }
+    t.error = max_ref > 0 ? max_diff/max_ref : max_diff;
+
+    free(net.input);
+    free(net.workspace);
+    free(out);
+    free(src);
+    return t;
+}
+
 void backward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
@@ -553,6 +727,9 @@ void update_convolutional_layer(convolutional_layer l, update_args a)
     axpy_cpu(l.nweights, -decay*batch, l.weights, 1, l.weight_updates, 1);
     axpy_cpu(l.nweights, learning_rate/batch, l.weight_updates, 1, l.weights, 1);
     scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+    transform_winograd_weights(l);
+    transform_direct_weights(l);
+    transform_xnor_weights(l);
 }
 
 
@@ -9,6 +9,13 @@
 
 typedef layer convolutional_layer;
 
+/* result of time_convolutional_paths */
+typedef struct{
+    double ref_time; /* seconds per forward of the reference path */
+    double time;     /* seconds per forward of the path under test */
+    float error;     /* largest output difference relative to the largest reference output */
+} conv_path_timing;
+
 #ifdef GPU
 void forward_convolutional_layer_gpu(convolutional_layer layer, network net);
 void backward_convolutional_layer_gpu(convolutional_layer layer, network net);
@@ -25,9 +32,12 @@ void cudnn_convolutional_setup(layer *l);
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int groups, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int train);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+size_t get_convolutional_train_workspace_size(convolutional_layer layer);
+int set_convolutional_algorithm(convolutional_layer *layer, int winograd_tile, int direct);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
+conv_path_timing time_convolutional_paths(convolutional_layer ref, convolutional_layer layer, network net, float range, int iterations);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
 void binarize_weights(float *weights, int n, int size, float *binary);
@@ -0,0 +1,73 @@
+#include "cpu_kernel.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_KERNEL_X86
+#endif
+
+/* __builtin_cpu_supports only takes string literals - every feature a kernel table may name is listed here */
+static int cpu_supports_one(const char *f, size_t n)
+{
+#ifdef CPU_KERNEL_X86
+#define CPU_FEATURE(s) if(n == sizeof(s) - 1 && !strncmp(f, s, n)) return __builtin_cpu_supports(s);
+    __builtin_cpu_init();
+    CPU_FEATURE("popcnt")
+    CPU_FEATURE("f16c")
+    CPU_FEATURE("fma")
+    CPU_FEATURE("avx2")
+    CPU_FEATURE("avx512f")
+    CPU_FEATURE("avx512vnni")
+    CPU_FEATURE("avx512vpopcntdq")
+#undef CPU_FEATURE
+#endif
+    return 0;
+}
+
+/* 1 if this cpu has every feature of the space separated list */
+int cpu_supports(const char *features)
+{
+    while(*features){
+        size_t n = strcspn(features, " ");
+        if(n && !cpu_supports_one(features, n)) return 0;
+        features += n;
+        features += strspn(features, " ");
+    }
+    return 1;
+}
+
+const cpu_kernel *cpu_kernel_entry(const cpu_kernel_table *t, int i)
+{
+    return (const cpu_kernel *)((const char *)t->entries + i*t->size);
+}
+
+int cpu_kernel_supported(const cpu_kernel_table *t, int i)
+{
+    return cpu_supports(cpu_kernel_entry(t, i)->features);
+}
+
+/* selected entry - picked on first use. threads racing here all pick the same entry, so the store is harmless */
+const void *cpu_kernel_get(cpu_kernel_table *t)
+{
+    const void *k = __atomic_load_n(&t->selected, __ATOMIC_ACQUIRE);
+    int i;
+    if(k) return k;
+    for(i = 0; i < t->count && !k; ++i){
+        if(cpu_kernel_supported(t, i)) k = cpu_kernel_entry(t, i);
+    }
+    __atomic_store_n(&t->selected, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+/* forces the entry called name - returns 0 (and keeps the current one) if there is none or this cpu lacks it */
+int cpu_kernel_set(cpu_kernel_table *t, const char *name)
+{
+    int i;
+    cpu_kernel_get(t); /* so a later first use can not replace the forced entry */
+    for(i = 0; i < t->count; ++i){
+        if(!strcmp(cpu_kernel_entry(t, i)->name, name) && cpu_kernel_supported(t, i)){
+            __atomic_store_n(&t->selected, cpu_kernel_entry(t, i), __ATOMIC_RELEASE);
+            return 1;
+        }
+    }
+    return 0;
+}
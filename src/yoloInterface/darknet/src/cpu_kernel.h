@@ -0,0 +1,29 @@
+#ifndef CPU_KERNEL_H
+#define CPU_KERNEL_H
+
+#include <stddef.h>
+
+/* Runtime choice between micro-kernels compiled for different instruction sets. A kernel table is an array of
+   structs whose first member is a cpu_kernel, fastest first: the first entry this cpu supports is used unless
+   another one is forced by name. */
+typedef struct{
+    const char *name;
+    const char *features; /* space separated __builtin_cpu_supports names the kernel needs, "" = any cpu */
+} cpu_kernel;
+
+typedef struct{
+    const void *entries;
+    int count;
+    size_t size; /* bytes per entry */
+    const void *selected;
+} cpu_kernel_table;
+
+#define CPU_KERNEL_TABLE(entries) {entries, sizeof(entries)/sizeof(entries[0]), sizeof(entries[0]), 0}
+
+int cpu_supports(const char *features);
+const cpu_kernel *cpu_kernel_entry(const cpu_kernel_table *t, int i);
+int cpu_kernel_supported(const cpu_kernel_table *t, int i);
+const void *cpu_kernel_get(cpu_kernel_table *t);
+int cpu_kernel_set(cpu_kernel_table *t, const char *name);
+
+#endif
@@ -0,0 +1,273 @@
+#include "direct_convolution.h"
+#include "convolutional_layer.h"
+#include "utils.h"
+#include "blas.h"
+#include "blocked_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+
+/* Direct convolution without im2col: weights are rearranged once to [filter block][channel][ky][kx][DIRECT_KB]
+   so DIRECT_KB filters are one vector, and each work item (one output row of one filter block) is computed
+   DIRECT_XB output columns at a time in a DIRECT_XB x DIRECT_KB register block: every input value is read once
+   from the image in place & broadcast against the filter vector. Vectorizing over filters keeps all simd lanes busy
+   on narrow maps and makes strided layers cost nothing extra. Bounds are checked once per block - blocks whose
+   input window lies inside the image (almost all of them) load without any checks, input rows outside the
+   image are skipped as a whole. 3x3 stride 1 / stride 2 get their own compiled copies. */
+
+#define DIRECT_KB 16 /* filters per register block - one simd lane each */
+#define DIRECT_XB 6  /* output columns per register block */
+
+#if BLOCKED_C != DIRECT_KB
+#error "a filter block of direct weights must be one NCHW16c channel block"
+#endif
+
+/* DIRECT_KB filters as one vector, each clone below lowers it to its own registers */
+typedef float direct_vec __attribute__((vector_size(DIRECT_KB*sizeof(float))));
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define DIRECT_SIMD __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define DIRECT_SIMD
+#endif
+
+/* floats in direct_weights */
+size_t get_direct_weights_size(layer l)
+{
+    int kblocks = (l.n/l.groups + DIRECT_KB - 1)/DIRECT_KB;
+    return (size_t)l.groups*kblocks*DIRECT_KB*(l.c/l.groups)*l.size*l.size;
+}
+
+/* enable = 0 keeps im2col. used for cpu layers that need im2col otherwise and do not run winograd.
+   1x1 layers are left alone - they never needed im2col (darknet reads their input directly, ignoring stride) */
+void setup_direct_convolution(layer *l, int enable)
+{
+    if(!enable) return;
+    if(l->winograd_tile || l->binary || l->xnor || l->size == 1) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    l->direct = 1;
+    l->direct_weights = calloc(get_direct_weights_size(*l), sizeof(float));
+    transform_direct_weights(*l);
+    l->workspace_size = 0;
+}
+
+/* direct convolution reading / writing NCHW16c tensors (blocked = BLOCKED_INPUT / BLOCKED_OUTPUT bits, see
+   blocked_layout.c) - 1x1 layers included. weights must still be fp32 */
+void setup_blocked_convolution(layer *l, int blocked)
+{
+    free(l->winograd_weights);
+    l->winograd_weights = 0;
+    l->winograd_tile = 0;
+    if(!l->direct){
+        l->direct = 1;
+        l->direct_weights = calloc(get_direct_weights_size(*l), sizeof(float));
+        transform_direct_weights(*l);
+    }
+    l->blocked = blocked;
+    l->workspace_size = 0;
+}
+
+/* l.weights into direct_weights layout (zero filters pad the last block) - must run again whenever l.weights change */
+void transform_direct_weights(layer l)
+{
+    if(!l.direct) return;
+    const int c = l.c/l.groups;
+    const int m = l.n/l.groups;
+    const int ss = l.size*l.size;
+    const int kblocks = (m + DIRECT_KB - 1)/DIRECT_KB;
+    int g, kb, ci, j, f;
+    for(g = 0; g < l.groups; ++g){
+        const float *weights = l.weights + (size_t)g*l.nweights/l.groups;
+        float *dst = l.direct_weights + (size_t)g*kblocks*DIRECT_KB*c*ss;
+        for(kb = 0; kb < kblocks; ++kb){
+            for(ci = 0; ci < c; ++ci){
+                for(j = 0; j < ss; ++j){
+                    for(f = 0; f < DIRECT_KB; ++f){
+                        int k = kb*DIRECT_KB + f;
+                        *dst++ = k < m ? weights[((size_t)k*c + ci)*ss + j] : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* ib / ob: channels per block of input / output - 1 for NCHW, BLOCKED_C for NCHW16c (blocked_layout.c) */
+static inline __attribute__((always_inline)) void direct_block(int size, int stride, int interior, int ib,
+        const float *in, int c, int h, int w, int pad, const float *weights,
+        int oy, int ox, int nx, direct_vec acc[DIRECT_XB])
+{
+    int ci, ky, kx, x;
+    for(x = 0; x < DIRECT_XB; ++x) acc[x] = (direct_vec){0};
+    for(ci = 0; ci < c; ++ci){
+        const float *plane = in + (size_t)(ci/ib)*h*w*ib + ci%ib;
+        for(ky = 0; ky < size; ++ky){
+            int iy = oy*stride + ky - pad;
+            if(iy < 0 || iy >= h) continue;
+            const float *row = plane + (size_t)iy*w*ib;
+            const float *wk = weights + (size_t)(ci*size + ky)*size*DIRECT_KB;
+            for(kx = 0; kx < size; ++kx){
+                const int x0 = ox*stride + kx - pad;
+                direct_vec wv;
+                memcpy(&wv, wk + kx*DIRECT_KB, sizeof(wv));
+                for(x = 0; x < DIRECT_XB; ++x){
+                    const int ix = x0 + x*stride;
+                    const float v = interior ? row[ix*ib] : ((x < nx && ix >= 0 && ix < w) ? row[ix*ib] : 0);
+                    acc[x] += v*wv;
+                }
+            }
+        }
+    }
+}
+
+/* output row oy of nk (<= DIRECT_KB) filters, from one block of direct weights - act(conv + bias), bias may be 0 */
+static inline __attribute__((always_inline)) void direct_row(int size, int stride, int ib, int ob,
+        const float *in, int c, int h, int w, int pad, const float *weights, int nk,
+        const float *bias, ACTIVATION act, float *out, int out_w, int out_hw, int oy)
+{
+    direct_vec acc[DIRECT_XB];
+    float res[DIRECT_XB][DIRECT_KB];
+    /* output columns [ox_lo, ox_hi) read only input columns inside the image */
+    const int ox_lo = (pad + stride - 1)/stride;
+    const int ox_hi = (w - size + pad)/stride + 1;
+    int f, x, ox;
+    for(ox = 0; ox < out_w; ox += DIRECT_XB){
+        int nx = out_w - ox < DIRECT_XB ? out_w - ox : DIRECT_XB;
+        if(nx == DIRECT_XB && ox >= ox_lo && ox + DIRECT_XB <= ox_hi){
+            direct_block(size, stride, 1, ib, in, c, h, w, pad, weights, oy, ox, nx, acc);
+        } else {
+            direct_block(size, stride, 0, ib, in, c, h, w, pad, weights, oy, ox, nx, acc);
+        }
+        memcpy(res, acc, sizeof(res));
+        if(ob == BLOCKED_C){
+            /* the DIRECT_KB filters of a block are the channels of one NCHW16c pixel - contiguous stores */
+            float *o = out + ((size_t)oy*out_w + ox)*DIRECT_KB;
+            for(x = 0; x < nx; ++x){
+                for(f = 0; f < DIRECT_KB; ++f) o[x*DIRECT_KB + f] = activate_inline(res[x][f] + (bias ? bias[f] : 0), act);
+            }
+            continue;
+        }
+        for(f = 0; f < nk; ++f){
+            float *o = out + (size_t)f*out_hw + oy*out_w + ox;
+            float b = bias ? bias[f] : 0;
+            for(x = 0; x < nx; ++x) o[x] = activate_inline(res[x][f] + b, act);
+        }
+    }
+}
+
+typedef void (*direct_row_func)(int size, int stride, int ib, int ob, const float *in, int c, int h, int w, int pad,
+        const float *weights, int nk, const float *bias, ACTIVATION act, float *out, int out_w, int out_hw, int oy);
+
+/* compiled copies for the common shapes & layouts, direct_row_any for the rest */
+#define DIRECT_ROW(name, SIZE, STRIDE, IB, OB) \
+DIRECT_SIMD \
+static void name(int size, int stride, int ib, int ob, const float *in, int c, int h, int w, int pad, \
+        const float *weights, int nk, const float *bias, ACTIVATION act, float *out, int out_w, int out_hw, int oy) \
+{ \
+    direct_row(SIZE, STRIDE, IB, OB, in, c, h, w, pad, weights, nk, bias, act, out, out_w, out_hw, oy); \
+}
+
+DIRECT_ROW(direct_row_3x3s1, 3, 1, 1, 1)
+DIRECT_ROW(direct_row_3x3s2, 3, 2, 1, 1)
+DIRECT_ROW(direct_row_blocked_3x3s1, 3, 1, DIRECT_KB, DIRECT_KB)
+DIRECT_ROW(direct_row_blocked_3x3s2, 3, 2, DIRECT_KB, DIRECT_KB)
+DIRECT_ROW(direct_row_blocked_1x1s1, 1, 1, DIRECT_KB, DIRECT_KB)
+DIRECT_ROW(direct_row_any, size, stride, ib, ob)
+
+/* fp16 weight blocks are expanded here before use - per calling thread, only grows */
+static const float *direct_half_block(const unsigned short *weights, size_t n)
+{
+    static __thread float *buf;
+    static __thread size_t size;
+    if(n > size){
+        free(buf);
+        buf = calloc(n, sizeof(float));
+        size = n;
+    }
+    half_to_float_cpu(weights, n, buf);
+    return buf;
+}
+
+/* writes convolution of net.input to l.output - with bias & activation applied as it is stored when the layer
+   has no batchnorm, otherwise the raw convolution. uses no workspace */
+void forward_direct_convolution(layer l, network net)
+{
+    const int c = l.c/l.groups;
+    const int m = l.n/l.groups;
+    const int out_hw = l.out_h*l.out_w;
+    const int kblocks = (m + DIRECT_KB - 1)/DIRECT_KB;
+    const size_t block_size = (size_t)DIRECT_KB*c*l.size*l.size;
+    const int fused = !l.batch_normalize;
+    const int ib = l.blocked & BLOCKED_INPUT ? BLOCKED_C : 1;
+    const int ob = l.blocked & BLOCKED_OUTPUT ? BLOCKED_C : 1;
+    direct_row_func row = direct_row_any;
+    int b, g;
+    if(ib == 1 && ob == 1 && l.size == 3 && l.stride == 1) row = direct_row_3x3s1;
+    if(ib == 1 && ob == 1 && l.size == 3 && l.stride == 2) row = direct_row_3x3s2;
+    if(ib == BLOCKED_C && ob == BLOCKED_C){
+        if(l.size == 3 && l.stride == 1) row = direct_row_blocked_3x3s1;
+        if(l.size == 3 && l.stride == 2) row = direct_row_blocked_3x3s2;
+        if(l.size == 1 && l.stride == 1) row = direct_row_blocked_1x1s1;
+    }
+
+    for(b = 0; b < l.batch; ++b){
+        for(g = 0; g < l.groups; ++g){
+            const float *in = net.input + (size_t)(b*l.groups + g)*c*l.h*l.w;
+            const size_t offset = g*kblocks*block_size;
+            float *out = l.output + (size_t)(b*l.groups + g)*m*out_hw;
+            int t;
+            /* rows outer so threads working at the same time share input rows */
+            #pragma omp parallel for schedule(dynamic)
+            for(t = 0; t < l.out_h*kblocks; ++t){
+                int oy = t / kblocks;
+                int kb = t % kblocks;
+                int nk = m - kb*DIRECT_KB < DIRECT_KB ? m - kb*DIRECT_KB : DIRECT_KB;
+                /* a whole block is expanded for one output row - one conversion per out_w*c*size*size multiplies */
+                const float *weights = l.half_weights ?
+                    direct_half_block((unsigned short *)l.direct_weights + offset + kb*block_size, block_size) :
+                    l.direct_weights + offset + kb*block_size;
+                row(l.size, l.stride, ib, ob, in, c, l.h, l.w, l.pad, weights, nk,
+                        fused ? l.biases + g*m + kb*DIRECT_KB : 0, fused ? l.activation : LINEAR,
+                        out + (size_t)kb*DIRECT_KB*out_hw, l.out_w, out_hw, oy);
+            }
+        }
+    }
+}
+
+/* times forward_convolutional_layer with im2col and direct on random input for every direct layer of net,
+   checks outputs agree & reports the workspace each path needs */
+void benchmark_direct_network(network *net, int iterations)
+{
+    struct rusage usage;
+    int i;
+    size_t im2col_max = 0;
+    size_t direct_max = 0;
+    double total_old = 0, total_new = 0;
+    getrusage(RUSAGE_SELF, &usage);
+    long rss_before = usage.ru_maxrss;
+    if(iterations < 1) iterations = 1;
+    printf("direct convolution benchmark, %d iteration(s) per layer\n", iterations);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.workspace_size > direct_max) direct_max = l.workspace_size;
+        if(l.type != CONVOLUTIONAL) continue;
+        size_t ws = l.direct ? get_convolutional_train_workspace_size(l) : l.workspace_size;
+        if(ws > im2col_max) im2col_max = ws;
+        if(!l.direct) continue;
+
+        layer im2col = l;
+        im2col.direct = 0;
+        conv_path_timing t = time_convolutional_paths(im2col, l, *net, 1, iterations);
+        total_old += t.ref_time;
+        total_new += t.time;
+        printf("layer %3d  %2dx%d/%d %4d x%4d x%4d -> %4d | im2col %9.3f ms, workspace %8.2f MB | direct %9.3f ms (x%.2f), no workspace | error %.1e\n",
+                i, l.size, l.size, l.stride, l.w, l.h, l.c, l.n, t.ref_time*1000, get_convolutional_train_workspace_size(l)/1048576., t.time*1000, t.ref_time/t.time, t.error);
+    }
+    printf("direct layers total: im2col %.3f ms, direct %.3f ms\n", total_old*1000, total_new*1000);
+    printf("network workspace: %.2f MB with im2col, %.2f MB with direct layers | peak RSS before benchmark %.2f MB\n",
+            im2col_max/1048576., direct_max/1048576., rss_before/1024.);
+}
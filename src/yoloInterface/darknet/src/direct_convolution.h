@@ -0,0 +1,12 @@
+#ifndef DIRECT_CONVOLUTION_H
+#define DIRECT_CONVOLUTION_H
+
+#include "darknet.h"
+
+void setup_direct_convolution(layer *l, int enable);
+void setup_blocked_convolution(layer *l, int blocked);
+void transform_direct_weights(layer l);
+size_t get_direct_weights_size(layer l);
+void forward_direct_convolution(layer l, network net);
+
+#endif
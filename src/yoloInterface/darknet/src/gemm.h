@@ -1,5 +1,7 @@
 #ifndef GEMM_H
 #define GEMM_H
+#include <stddef.h>
+#include "darknet.h"
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -12,6 +14,48 @@ void gemm(int TA, int TB, int M, int N, int K, float ALPHA,
                     float BETA,
                     float *C, int ldc);
 
+/* rows [row0, row0 + rows) of B are read as a stride x nearest neighbour upsample of src (rows planes of
+   (w/stride) x (N/w/stride)) instead of from B - a 1x1 convolution reads route(upsample(x), ...) without the upsample
+   ever being written (see memory_plan.c) */
+typedef struct{
+    const float *src;
+    int row0, rows;
+    int stride;
+    int w, h; /* size of the image each row of B is */
+} gemm_upsample_rows;
+
+/* cache blocked packed gemm with runtime selected simd micro-kernel (see gemm_packed.c) - used by gemm() */
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA, 
+        float *A, int lda, 
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+void gemm_packed_bias_activate(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        const float *bias, ACTIVATION a,
+        const gemm_upsample_rows *up);
+size_t gemm_packed_a_size(int M, int K);
+void gemm_pack_a(int TA, int M, int K, float *A, int lda, float *packed);
+void gemm_packed_a(int TB, int M, int N, int K, const float *packed_a,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+/* fp16 A, expanded to fp32 with F16C as panels are packed */
+void gemm_packed_half_bias_activate(int M, int N, int K,
+        const unsigned short *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        const float *bias, ACTIVATION a,
+        const gemm_upsample_rows *up);
+void gemm_packed_a_half(int TB, int M, int N, int K, const unsigned short *packed_a,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+int gemm_packed_set_kernel(const char *name);
+const char *gemm_packed_kernel_name(void);
+
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
@@ -0,0 +1,560 @@
+#include "gemm.h"
+#include "utils.h"
+#include "blas.h"
+#include "activations.h"
+#include "cpu_kernel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86
+#endif
+
+/* Cache blocked gemm on packed panels (BLIS style):
+   for each KC slice of K all of op(A)*ALPHA is packed into MR row micro-panels (stays in L2 per MC block),
+   for each NC slice of N op(B) is packed into NR column micro-panels (one panel stays in L1 across an MC block),
+   then MC x NB tiles of C are spread over threads (2D, so layers with few filters still use every core)
+   and each tile is computed by a MR x NR register tiled FMA micro-kernel picked at runtime. */
+
+#define GEMM_KC 256
+#define GEMM_MR 6     /* rows of every micro-kernel - so packed A does not depend on the kernel */
+#define GEMM_MC 96    /* multiple of GEMM_MR */
+#define GEMM_NB 384   /* columns of C per parallel work item - multiple of every NR */
+#define GEMM_NC 3072  /* multiple of GEMM_NB */
+#define GEMM_MAX_NR 32
+
+/* how a micro-kernel writes its tile: c = (load ? c : 0) + acc + bias[row], then max(c, slope*c) -
+   bias & slope are only set on the last K slice, so bias + leaky / relu never take an extra pass over C */
+typedef struct{
+    int load;
+    const float *bias; /* per row of the tile, 0 = none */
+    float slope;       /* 1 = none, .1 = leaky, 0 = relu */
+} gemm_store;
+
+typedef void (*gemm_micro_kernel)(int kc, const float *a, const float *b, float *c, int ldc, const gemm_store *st);
+
+typedef struct{
+    cpu_kernel cpu;
+    int nr;
+    gemm_micro_kernel kernel;
+} gemm_kernel_info;
+
+/* c[MR x NR] (+)= a (kc x MR packed) * b (kc x NR packed), written as st says
+   portable kernel - 6x8 accumulators still fit in 16 sse / neon registers, so the compiler keeps them there */
+static void gemm_kernel_generic_6x8(int kc, const float *a, const float *b, float *c, int ldc, const gemm_store *st)
+{
+    float acc[6][8] = {{0}};
+    int i, j, k;
+    for(k = 0; k < kc; ++k){
+        for(i = 0; i < 6; ++i){
+            for(j = 0; j < 8; ++j){
+                acc[i][j] += a[i]*b[j];
+            }
+        }
+        a += 6;
+        b += 8;
+    }
+    for(i = 0; i < 6; ++i){
+        float bias = st->bias ? st->bias[i] : 0;
+        for(j = 0; j < 8; ++j){
+            float v = acc[i][j] + bias;
+            if(st->load) v += c[i*ldc + j];
+            c[i*ldc + j] = v > st->slope*v ? v : st->slope*v;
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+#define AVX2_ROW(r) \
+    ar = _mm256_broadcast_ss(a + r); \
+    c##r##0 = _mm256_fmadd_ps(ar, b0, c##r##0); \
+    c##r##1 = _mm256_fmadd_ps(ar, b1, c##r##1);
+
+#define AVX2_STORE(r) \
+    _mm256_storeu_ps(c + r*ldc, avx2_store_value(c##r##0, c + r*ldc, st, r)); \
+    _mm256_storeu_ps(c + r*ldc + 8, avx2_store_value(c##r##1, c + r*ldc + 8, st, r));
+
+__attribute__((target("avx2,fma")))
+static inline __m256 avx2_store_value(__m256 v, const float *c, const gemm_store *st, int r)
+{
+    if(st->load) v = _mm256_add_ps(v, _mm256_loadu_ps(c));
+    if(st->bias) v = _mm256_add_ps(v, _mm256_broadcast_ss(st->bias + r));
+    if(st->slope != 1) v = _mm256_max_ps(v, _mm256_mul_ps(v, _mm256_set1_ps(st->slope)));
+    return v;
+}
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2_6x16(int kc, const float *a, const float *b, float *c, int ldc, const gemm_store *st)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    __m256 ar;
+    int k;
+    for(k = 0; k < kc; ++k){
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        AVX2_ROW(0) AVX2_ROW(1) AVX2_ROW(2) AVX2_ROW(3) AVX2_ROW(4) AVX2_ROW(5)
+        a += 6;
+        b += 16;
+    }
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2) AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+}
+
+#define AVX512_ROW(r) \
+    ar = _mm512_set1_ps(a[r]); \
+    c##r##0 = _mm512_fmadd_ps(ar, b0, c##r##0); \
+    c##r##1 = _mm512_fmadd_ps(ar, b1, c##r##1);
+
+#define AVX512_STORE(r) \
+    _mm512_storeu_ps(c + r*ldc, avx512_store_value(c##r##0, c + r*ldc, st, r)); \
+    _mm512_storeu_ps(c + r*ldc + 16, avx512_store_value(c##r##1, c + r*ldc + 16, st, r));
+
+__attribute__((target("avx512f")))
+static inline __m512 avx512_store_value(__m512 v, const float *c, const gemm_store *st, int r)
+{
+    if(st->load) v = _mm512_add_ps(v, _mm512_loadu_ps(c));
+    if(st->bias) v = _mm512_add_ps(v, _mm512_set1_ps(st->bias[r]));
+    if(st->slope != 1) v = _mm512_max_ps(v, _mm512_mul_ps(v, _mm512_set1_ps(st->slope)));
+    return v;
+}
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512_6x32(int kc, const float *a, const float *b, float *c, int ldc, const gemm_store *st)
+{
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    __m512 ar;
+    int k;
+    for(k = 0; k < kc; ++k){
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        AVX512_ROW(0) AVX512_ROW(1) AVX512_ROW(2) AVX512_ROW(3) AVX512_ROW(4) AVX512_ROW(5)
+        a += 6;
+        b += 32;
+    }
+    AVX512_STORE(0) AVX512_STORE(1) AVX512_STORE(2) AVX512_STORE(3) AVX512_STORE(4) AVX512_STORE(5)
+}
+
+#endif
+
+static const gemm_kernel_info gemm_kernels[] = {
+#ifdef GEMM_X86
+    {{"avx512", "avx512f"}, 32, gemm_kernel_avx512_6x32},
+    {{"avx2", "avx2 fma"}, 16, gemm_kernel_avx2_6x16},
+#endif
+    {{"generic", ""}, 8, gemm_kernel_generic_6x8}
+};
+static cpu_kernel_table gemm_kernel_table = CPU_KERNEL_TABLE(gemm_kernels);
+
+static const gemm_kernel_info *get_gemm_kernel(void)
+{
+    return cpu_kernel_get(&gemm_kernel_table);
+}
+
+/* forces a kernel ("avx512", "avx2", "generic") - returns 0 if not available on this cpu */
+int gemm_packed_set_kernel(const char *name)
+{
+    return cpu_kernel_set(&gemm_kernel_table, name);
+}
+
+const char *gemm_packed_kernel_name(void)
+{
+    return get_gemm_kernel()->cpu.name;
+}
+
+/* packing buffers only grow - per calling thread so independent networks can run concurrently.
+   registered under a pthread key so they are freed when their thread exits */
+typedef struct{
+    float *buf[2];
+    size_t size[2];
+} gemm_buffers;
+
+static pthread_key_t gemm_buffers_key;
+static pthread_once_t gemm_buffers_once = PTHREAD_ONCE_INIT;
+
+static void free_gemm_buffers(void *p)
+{
+    gemm_buffers *b = p;
+    free(b->buf[0]);
+    free(b->buf[1]);
+    free(b);
+}
+
+static void make_gemm_buffers_key(void)
+{
+    pthread_key_create(&gemm_buffers_key, free_gemm_buffers);
+}
+
+static float *gemm_buffer(int which, size_t n)
+{
+    static __thread gemm_buffers *b;
+    if(!b){
+        pthread_once(&gemm_buffers_once, make_gemm_buffers_key);
+        b = calloc(1, sizeof(gemm_buffers));
+        pthread_setspecific(gemm_buffers_key, b);
+    }
+    if(n > b->size[which]){
+        free(b->buf[which]);
+        b->buf[which] = aligned_alloc(64, (n*sizeof(float) + 63)/64*64);
+        b->size[which] = n;
+    }
+    return b->buf[which];
+}
+
+/* rows [0, M) of ALPHA*op(A), columns [p0, p0+kc) into MR row panels, zero padded */
+static void pack_a(int TA, int M, int p0, int kc, float ALPHA, float *A, int lda, float *dst)
+{
+    const int mr = GEMM_MR;
+    int panels = (M + mr - 1)/mr;
+    int p;
+    #pragma omp parallel for
+    for(p = 0; p < panels; ++p){
+        float *d = dst + (size_t)p*kc*mr;
+        int i0 = p*mr;
+        int m = M - i0 < mr ? M - i0 : mr;
+        int i, k;
+        for(k = 0; k < kc; ++k){
+            for(i = 0; i < m; ++i){
+                d[i] = ALPHA*(TA ? A[(size_t)(p0 + k)*lda + i0 + i] : A[(size_t)(i0 + i)*lda + p0 + k]);
+            }
+            for(; i < mr; ++i) d[i] = 0;
+            d += mr;
+        }
+    }
+}
+
+/* pack_a for fp16 A (row major, ALPHA = 1) - every row slice is expanded to fp32 with F16C, then interleaved */
+static void pack_a_half(int M, int p0, int kc, const unsigned short *A, int lda, float *dst)
+{
+    const int mr = GEMM_MR;
+    int panels = (M + mr - 1)/mr;
+    int p;
+    #pragma omp parallel for
+    for(p = 0; p < panels; ++p){
+        float *d = dst + (size_t)p*kc*mr;
+        float row[GEMM_KC];
+        int i0 = p*mr;
+        int m = M - i0 < mr ? M - i0 : mr;
+        int i, k;
+        for(i = 0; i < mr; ++i){
+            if(i < m){
+                half_to_float_cpu(A + (size_t)(i0 + i)*lda + p0, kc, row);
+                for(k = 0; k < kc; ++k) d[k*mr + i] = row[k];
+            } else {
+                for(k = 0; k < kc; ++k) d[k*mr + i] = 0;
+            }
+        }
+    }
+}
+
+/* row r of B, columns [j, j+n), read through up (gemm_upsample_rows) - walks x / y instead of dividing per column */
+static void upsample_row(const gemm_upsample_rows *up, int r, int j, int n, float *d)
+{
+    const int s = up->stride;
+    const int sw = up->w/s;
+    const float *plane = up->src + (size_t)(r - up->row0)*sw*(up->h/s);
+    int x = j % up->w, y = j / up->w, i;
+    const float *row = plane + (y/s)*sw;
+    for(i = 0; i < n; ++i){
+        d[i] = row[x/s];
+        if(++x == up->w){
+            x = 0;
+            row = plane + (++y/s)*sw;
+        }
+    }
+}
+
+/* rows [p0, p0+kc), columns [j0, j0+nc) of op(B) into NR column panels, zero padded. rows of up are read through it */
+static void pack_b(int TB, int p0, int kc, int j0, int nc, float *B, int ldb, int nr, const gemm_upsample_rows *up, float *dst)
+{
+    int panels = (nc + nr - 1)/nr;
+    int p;
+    #pragma omp parallel for
+    for(p = 0; p < panels; ++p){
+        float *d = dst + (size_t)p*kc*nr;
+        int jp = j0 + p*nr;
+        int n = nc - p*nr < nr ? nc - p*nr : nr;
+        int j, k;
+        for(k = 0; k < kc; ++k){
+            if(up && p0 + k >= up->row0 && p0 + k < up->row0 + up->rows){
+                upsample_row(up, p0 + k, jp, n, d);
+                j = n;
+            } else if(TB){
+                for(j = 0; j < n; ++j) d[j] = B[(size_t)(jp + j)*ldb + p0 + k];
+            } else {
+                memcpy(d, B + (size_t)(p0 + k)*ldb + jp, n*sizeof(float));
+                j = n;
+            }
+            for(; j < nr; ++j) d[j] = 0;
+            d += nr;
+        }
+    }
+}
+
+/* BETA = 0 never reads C (the kernels overwrite it), so garbage / NaN in C does not leak through */
+static void scale_c(int M, int N, float BETA, float *C, int ldc)
+{
+    int i, j;
+    if(BETA == 1 || BETA == 0) return;
+    for(i = 0; i < M; ++i){
+        for(j = 0; j < N; ++j){
+            C[i*ldc + j] *= BETA;
+        }
+    }
+}
+
+/* slope of max(x, slope*x) that is activation a, or -1 when a has no such form */
+static float gemm_activation_slope(ACTIVATION a)
+{
+    if(a == LINEAR) return 1;
+    if(a == LEAKY) return .1;
+    if(a == RELU) return 0;
+    return -1;
+}
+
+/* C = a((load ? C : 0) + ALPHA*op(A)*op(B) + bias[row]) - A is packed here unless packed_a (from gemm_pack_a) is given.
+   with a_half, A (TA = 0, ALPHA = 1) or packed_a hold fp16 and each KC slice is expanded to fp32 as it is packed.
+   bias may be 0. leaky / relu / linear are applied by the micro-kernel store, other activations right after it on
+   the tile it just wrote */
+static void gemm_packed_run(int TA, int TB, int M, int N, int K, float ALPHA,
+        const void *A, int lda, const void *packed_a, int a_half,
+        float *B, int ldb,
+        int load, float *C, int ldc,
+        const float *bias, ACTIVATION act,
+        const gemm_upsample_rows *up)
+{
+    if(M <= 0 || N <= 0) return;
+    if(K <= 0){
+        int i, j;
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                float v = (load ? C[(size_t)i*ldc + j] : 0) + (bias ? bias[i] : 0);
+                C[(size_t)i*ldc + j] = activate(v, act);
+            }
+        }
+        return;
+    }
+    const float act_slope = gemm_activation_slope(act);
+
+    const gemm_kernel_info *ki = get_gemm_kernel();
+    const int mr = GEMM_MR;
+    const int nr = ki->nr;
+    const int mpad = (M + mr - 1)/mr*mr;
+    const int ncmax = N < GEMM_NC ? N : GEMM_NC;
+    float *pa = packed_a && !a_half ? 0 : gemm_buffer(0, (size_t)mpad*GEMM_KC);
+    float *pb = gemm_buffer(1, (size_t)((ncmax + nr - 1)/nr)*nr*GEMM_KC);
+
+    int pc, jc;
+    for(pc = 0; pc < K; pc += GEMM_KC){
+        int kc = K - pc < GEMM_KC ? K - pc : GEMM_KC;
+        const float *pap = pa;
+        if(packed_a && a_half){
+            half_to_float_cpu((const unsigned short *)packed_a + (size_t)mpad*pc, (size_t)mpad*kc, pa);
+        } else if(packed_a){
+            pap = (const float *)packed_a + (size_t)mpad*pc;
+        } else if(a_half){
+            pack_a_half(M, pc, kc, A, lda, pa);
+        } else {
+            pack_a(TA, M, pc, kc, ALPHA, (float *)A, lda, pa);
+        }
+
+        for(jc = 0; jc < N; jc += GEMM_NC){
+            int nc = N - jc < GEMM_NC ? N - jc : GEMM_NC;
+            pack_b(TB, pc, kc, jc, nc, B, ldb, nr, up, pb);
+
+            const int last = pc + kc >= K;
+            gemm_store st = {load || pc > 0, 0, 1};
+            if(last && act_slope >= 0) st.slope = act_slope;
+            int mblocks = (M + GEMM_MC - 1)/GEMM_MC;
+            int nblocks = (nc + GEMM_NB - 1)/GEMM_NB;
+            int t;
+            #pragma omp parallel for schedule(dynamic)
+            for(t = 0; t < mblocks*nblocks; ++t){
+                int i0 = (t / nblocks)*GEMM_MC;
+                int j0 = (t % nblocks)*GEMM_NB;
+                int i1 = i0 + GEMM_MC < M ? i0 + GEMM_MC : M;
+                int j1 = j0 + GEMM_NB < nc ? j0 + GEMM_NB : nc;
+                int ir, jr;
+                for(jr = j0; jr < j1; jr += nr){
+                    const float *bp = pb + (size_t)(jr/nr)*kc*nr;
+                    int n = j1 - jr < nr ? j1 - jr : nr;
+                    for(ir = i0; ir < i1; ir += mr){
+                        const float *ap = pap + (size_t)(ir/mr)*kc*mr;
+                        int m = i1 - ir < mr ? i1 - ir : mr;
+                        float *c = C + (size_t)ir*ldc + jc + jr;
+                        int r, s;
+                        if(m == mr && n == nr){
+                            gemm_store tile = st;
+                            if(last) tile.bias = bias ? bias + ir : 0;
+                            ki->kernel(kc, ap, bp, c, ldc, &tile);
+                        } else {
+                            /* edge tile - full tile into scratch, valid part written to C */
+                            static const gemm_store plain = {0, 0, 1};
+                            float tmp[GEMM_MR*GEMM_MAX_NR];
+                            ki->kernel(kc, ap, bp, tmp, nr, &plain);
+                            for(r = 0; r < m; ++r){
+                                float add = last && bias ? bias[ir + r] : 0;
+                                for(s = 0; s < n; ++s){
+                                    float v = tmp[r*nr + s] + add;
+                                    if(st.load) v += c[(size_t)r*ldc + s];
+                                    c[(size_t)r*ldc + s] = v > st.slope*v ? v : st.slope*v;
+                                }
+                            }
+                        }
+                        if(last && act_slope < 0){
+                            for(r = 0; r < m; ++r) activate_array(c + (size_t)r*ldc, n, act);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    scale_c(M, N, BETA, C, ldc);
+    gemm_packed_run(TA, TB, M, N, K, ALPHA, A, lda, 0, 0, B, ldb, BETA != 0, C, ldc, 0, LINEAR, 0);
+}
+
+/* C = a(ALPHA*op(A)*op(B) + bias[row]) in one pass over C - the fused convolution epilogue (bias may be 0) */
+void gemm_packed_bias_activate(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        const float *bias, ACTIVATION a,
+        const gemm_upsample_rows *up)
+{
+    gemm_packed_run(TA, TB, M, N, K, ALPHA, A, lda, 0, 0, B, ldb, 0, C, ldc, bias, a, up);
+}
+
+/* gemm_packed_bias_activate with fp16 A (M x K row major, ALPHA = 1) - half the weight memory & bandwidth */
+void gemm_packed_half_bias_activate(int M, int N, int K,
+        const unsigned short *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        const float *bias, ACTIVATION a,
+        const gemm_upsample_rows *up)
+{
+    gemm_packed_run(0, 0, M, N, K, 1, A, lda, 0, 1, B, ldb, 0, C, ldc, bias, a, up);
+}
+
+/* floats needed by gemm_pack_a for a M x K matrix */
+size_t gemm_packed_a_size(int M, int K)
+{
+    return (size_t)(M + GEMM_MR - 1)/GEMM_MR*GEMM_MR*K;
+}
+
+/* packs op(A) once for repeated gemm_packed_a calls (constant weights) - same layout for every kernel */
+void gemm_pack_a(int TA, int M, int K, float *A, int lda, float *packed)
+{
+    const int mpad = (M + GEMM_MR - 1)/GEMM_MR*GEMM_MR;
+    int pc;
+    for(pc = 0; pc < K; pc += GEMM_KC){
+        int kc = K - pc < GEMM_KC ? K - pc : GEMM_KC;
+        pack_a(TA, M, pc, kc, 1, A, lda, packed + (size_t)mpad*pc);
+    }
+}
+
+/* gemm_packed with A already packed by gemm_pack_a - saves packing A on every call, which dominates when N is small */
+void gemm_packed_a(int TB, int M, int N, int K, const float *packed_a,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    scale_c(M, N, BETA, C, ldc);
+    gemm_packed_run(0, TB, M, N, K, 1, 0, 0, packed_a, 0, B, ldb, BETA != 0, C, ldc, 0, LINEAR, 0);
+}
+
+/* gemm_packed_a with the output of gemm_pack_a converted to fp16 */
+void gemm_packed_a_half(int TB, int M, int N, int K, const unsigned short *packed_a,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    scale_c(M, N, BETA, C, ldc);
+    gemm_packed_run(0, TB, M, N, K, 1, 0, 0, packed_a, 1, B, ldb, BETA != 0, C, ldc, 0, LINEAR, 0);
+}
+
+/* GFLOP/s of gemm_cpu (old kernel) against gemm_packed with every kernel this cpu supports,
+   for each distinct convolution shape of net (M = filters, N = output pixels, K = size*size*channels) */
+void benchmark_gemm_network(network *net, int iterations)
+{
+    int seen[256][3];
+    int nseen = 0;
+    int i, j, s, it;
+    const gemm_kernel_info *selected = get_gemm_kernel();
+    if(iterations < 1) iterations = 1;
+    printf("gemm benchmark, %d iteration(s) per shape, default kernel: %s\n", iterations, selected->cpu.name);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL) continue;
+        int M = l.n/l.groups;
+        int N = l.out_w*l.out_h;
+        int K = l.size*l.size*l.c/l.groups;
+        for(s = 0; s < nseen; ++s){
+            if(seen[s][0] == M && seen[s][1] == N && seen[s][2] == K) break;
+        }
+        if(s < nseen) continue;
+        if(nseen < 256){
+            seen[nseen][0] = M;
+            seen[nseen][1] = N;
+            seen[nseen][2] = K;
+            ++nseen;
+        }
+
+        float *a = random_matrix(M, K);
+        float *b = random_matrix(K, N);
+        float *c_ref = calloc((size_t)M*N, sizeof(float));
+        float *c = calloc((size_t)M*N, sizeof(float));
+        double gflop = 2.*M*N*K*iterations/1e9;
+
+        double t1 = what_time_is_it_now();
+        for(it = 0; it < iterations; ++it){
+            memset(c_ref, 0, (size_t)M*N*sizeof(float));
+            gemm_cpu(0, 0, M, N, K, 1, a, K, b, N, 1, c_ref, N);
+        }
+        double t_old = what_time_is_it_now() - t1;
+        printf("layer %3d  M %4d  N %6d  K %5d | old %7.2f GFLOP/s", i, M, N, K, gflop/t_old);
+
+        for(j = 0; j < gemm_kernel_table.count; ++j){
+            if(!gemm_packed_set_kernel(gemm_kernels[j].cpu.name)) continue;
+            t1 = what_time_is_it_now();
+            for(it = 0; it < iterations; ++it){
+                memset(c, 0, (size_t)M*N*sizeof(float));
+                gemm_packed(0, 0, M, N, K, 1, a, K, b, N, 1, c, N);
+            }
+            double t_new = what_time_is_it_now() - t1;
+            float max_diff = 0;
+            for(s = 0; s < M*N; ++s){
+                float d = fabs(c[s] - c_ref[s])/(fabs(c_ref[s]) + 1);
+                if(d > max_diff) max_diff = d;
+            }
+            printf(" | %s %7.2f GFLOP/s (x%.1f, rel diff %.1e)", gemm_kernels[j].cpu.name, gflop/t_new, t_old/t_new, max_diff);
+        }
+        printf("\n");
+        gemm_packed_set_kernel(selected->cpu.name);
+
+        free(a);
+        free(b);
+        free(c_ref);
+        free(c);
+    }
+}
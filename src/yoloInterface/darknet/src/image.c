@@ -830,6 +830,89 @@ image letterbox_image(image im, int w, int h)
     return boxed;
 }
 
+static void letterbox_bgr8_row(unsigned char *row, int w, int new_w, int *ix, float *fx, float *lut, float *part)
+{
+    int c, k;
+    for(k = 0; k < 3; ++k){
+        float *out = part + k*new_w;
+        unsigned char *src = row + 2 - k;
+        for(c = 0; c < new_w; ++c){
+            if(c == new_w-1 || w == 1){
+                out[c] = lut[src[3*(w-1)]];
+            } else {
+                out[c] = (1 - fx[c]) * lut[src[3*ix[c]]] + fx[c] * lut[src[3*(ix[c]+1)]];
+            }
+        }
+    }
+}
+
+/* Same result as letterbox_image(BGR -> RGB float image /255, w, h), computed in one pass straight from
+   8-bit interleaved BGR rows (e.g. cv::Mat data) into planar network input - no intermediate images */
+void letterbox_bgr8_into(unsigned char *bgr, int w, int h, int step, int net_w, int net_h, float *dst)
+{
+    int new_w = w;
+    int new_h = h;
+    if (((float)net_w/w) < ((float)net_h/h)) {
+        new_w = net_w;
+        new_h = (h * net_w)/w;
+    } else {
+        new_h = net_h;
+        new_w = (w * net_h)/h;
+    }
+    int dx = (net_w-new_w)/2;
+    int dy = (net_h-new_h)/2;
+
+    int i, c;
+    float lut[256];
+    for(i = 0; i < 256; ++i) lut[i] = (float)i/255;
+
+    /* stack buffers - called every frame, new_w <= net_w */
+    int ix[new_w];
+    float fx[new_w];
+    float w_scale = (float)(w - 1) / (new_w - 1);
+    float h_scale = (float)(h - 1) / (new_h - 1);
+    for(c = 0; c < new_w - 1; ++c){
+        float sx = c*w_scale;
+        ix[c] = (int) sx;
+        fx[c] = sx - ix[c];
+    }
+
+    #pragma omp parallel
+    {
+        float part[2*3*new_w];
+        int r, k, j;
+        #pragma omp for
+        for(r = 0; r < net_h; ++r){
+            int sr = r - dy;
+            if(sr < 0 || sr >= new_h){
+                for(k = 0; k < 3; ++k) fill_cpu(net_w, .5, dst + k*net_w*net_h + r*net_w, 1);
+                continue;
+            }
+            float sy = sr*h_scale;
+            int iy = (int) sy;
+            float fy = sy - iy;
+            int next = !(sr == new_h-1 || h == 1);
+
+            letterbox_bgr8_row(bgr + (size_t)iy*step, w, new_w, ix, fx, lut, part);
+            if(next) letterbox_bgr8_row(bgr + (size_t)(iy+1)*step, w, new_w, ix, fx, lut, part + 3*new_w);
+
+            for(k = 0; k < 3; ++k){
+                float *out = dst + k*net_w*net_h + r*net_w;
+                float *p0 = part + k*new_w;
+                float *p1 = part + (3 + k)*new_w;
+                for(j = 0; j < dx; ++j) out[j] = .5;
+                for(j = dx + new_w; j < net_w; ++j) out[j] = .5;
+                out += dx;
+                if(next){
+                    for(j = 0; j < new_w; ++j) out[j] = (1-fy) * p0[j] + fy * p1[j];
+                } else {
+                    for(j = 0; j < new_w; ++j) out[j] = (1-fy) * p0[j];
+                }
+            }
+        }
+    }
+}
+
 image resize_max(image im, int max)
 {
     int w = im.w;
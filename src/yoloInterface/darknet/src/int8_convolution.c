@@ -0,0 +1,533 @@
+#include "int8_convolution.h"
+#include "convolutional_layer.h"
+#include "activations.h"
+#include "utils.h"
+#include "blas.h"
+#include "cpu_kernel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INT8_X86
+#endif
+
+/* INT8 inference of calibrated convolutions:
+   weights are quantized once, symmetric per filter: w = wscale[f]*wq with wq in [-127, 127].
+   the input is quantized per frame, symmetric per layer from the range seen in calibration: x = xscale*xq with
+   xq in [-qmax, qmax], stored as xq + zp (zp = qmax + 1) because the simd dot products multiply unsigned by signed
+   bytes. so acc = sum wq*(xq + zp) and conv = wscale*xscale*(acc - zp*sum wq) - the kernel applies that, bias and
+   the activation as it stores its tile (same epilogue as the float gemm).
+   the byte im2col of the input is packed in panels of 4 consecutive k per column (the vpdpbusd / pmaddubsw layout).
+   pmaddubsw adds byte products pairwise into saturating int16, so that kernel quantizes input to 7 bits (qmax 63)
+   and stays exact - vnni & generic use the full 8 bits. */
+
+#define INT8_MR 6     /* rows of every micro-kernel - packed weights do not depend on the kernel */
+#define INT8_MC 96    /* multiple of INT8_MR */
+#define INT8_NB 384   /* columns of output per parallel work item - multiple of every NR */
+#define INT8_MAX_NR 32
+
+/* how a micro-kernel turns its int32 tile into output: c = max(v, slope*v), v = (acc - zp*sums[r])*wscales[r]*xscale + bias[r] */
+typedef struct{
+    const int *sums;
+    const float *wscales;
+    const float *bias;
+    float xscale;
+    int zp;
+    float slope; /* 1 = none, .1 = leaky, 0 = relu - other activations are applied right after the store */
+} int8_store;
+
+typedef void (*int8_micro_kernel)(int k4, const signed char *a, const unsigned char *b, float *c, int ldc, const int8_store *st);
+
+typedef struct{
+    cpu_kernel cpu;
+    int nr;
+    int qmax;
+    int8_micro_kernel kernel;
+} int8_kernel_info;
+
+static inline int int8_load4(const signed char *p)
+{
+    int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* portable kernel - 6x8 int32 accumulators */
+static void int8_kernel_generic_6x8(int k4, const signed char *a, const unsigned char *b, float *c, int ldc, const int8_store *st)
+{
+    int acc[6][8] = {{0}};
+    int i, j, k, q;
+    for(k = 0; k < k4; ++k){
+        for(i = 0; i < 6; ++i){
+            for(j = 0; j < 8; ++j){
+                for(q = 0; q < 4; ++q) acc[i][j] += a[i*4 + q]*b[j*4 + q];
+            }
+        }
+        a += 24;
+        b += 32;
+    }
+    for(i = 0; i < 6; ++i){
+        float scale = st->wscales[i]*st->xscale;
+        int offset = st->zp*st->sums[i];
+        for(j = 0; j < 8; ++j){
+            float v = (acc[i][j] - offset)*scale + st->bias[i];
+            c[i*ldc + j] = v > st->slope*v ? v : st->slope*v;
+        }
+    }
+}
+
+#ifdef INT8_X86
+
+#define AVX2_ROW(r) \
+    ar = _mm256_set1_epi32(int8_load4(a + 4*r)); \
+    c##r##0 = _mm256_add_epi32(c##r##0, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, ar), ones)); \
+    c##r##1 = _mm256_add_epi32(c##r##1, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, ar), ones));
+
+#define AVX2_STORE(r) \
+    _mm256_storeu_ps(c + r*ldc, int8_avx2_store_value(c##r##0, st, r)); \
+    _mm256_storeu_ps(c + r*ldc + 8, int8_avx2_store_value(c##r##1, st, r));
+
+__attribute__((target("avx2,fma")))
+static inline __m256 int8_avx2_store_value(__m256i acc, const int8_store *st, int r)
+{
+    __m256 v = _mm256_cvtepi32_ps(_mm256_sub_epi32(acc, _mm256_set1_epi32(st->zp*st->sums[r])));
+    v = _mm256_fmadd_ps(v, _mm256_set1_ps(st->wscales[r]*st->xscale), _mm256_set1_ps(st->bias[r]));
+    if(st->slope != 1) v = _mm256_max_ps(v, _mm256_mul_ps(v, _mm256_set1_ps(st->slope)));
+    return v;
+}
+
+/* pmaddubsw: u8*s8 pairs into int16 (exact for 7 bit input), pmaddwd against ones into int32 */
+__attribute__((target("avx2,fma")))
+static void int8_kernel_avx2_6x16(int k4, const signed char *a, const unsigned char *b, float *c, int ldc, const int8_store *st)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    __m256i c40 = _mm256_setzero_si256(), c41 = _mm256_setzero_si256();
+    __m256i c50 = _mm256_setzero_si256(), c51 = _mm256_setzero_si256();
+    __m256i ar;
+    int k;
+    for(k = 0; k < k4; ++k){
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)b);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+        AVX2_ROW(0) AVX2_ROW(1) AVX2_ROW(2) AVX2_ROW(3) AVX2_ROW(4) AVX2_ROW(5)
+        a += 24;
+        b += 64;
+    }
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2) AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+}
+
+#define VNNI_ROW(r) \
+    ar = _mm512_set1_epi32(int8_load4(a + 4*r)); \
+    c##r##0 = _mm512_dpbusd_epi32(c##r##0, b0, ar); \
+    c##r##1 = _mm512_dpbusd_epi32(c##r##1, b1, ar);
+
+#define VNNI_STORE(r) \
+    _mm512_storeu_ps(c + r*ldc, int8_avx512_store_value(c##r##0, st, r)); \
+    _mm512_storeu_ps(c + r*ldc + 16, int8_avx512_store_value(c##r##1, st, r));
+
+__attribute__((target("avx512f")))
+static inline __m512 int8_avx512_store_value(__m512i acc, const int8_store *st, int r)
+{
+    __m512 v = _mm512_cvtepi32_ps(_mm512_sub_epi32(acc, _mm512_set1_epi32(st->zp*st->sums[r])));
+    v = _mm512_fmadd_ps(v, _mm512_set1_ps(st->wscales[r]*st->xscale), _mm512_set1_ps(st->bias[r]));
+    if(st->slope != 1) v = _mm512_max_ps(v, _mm512_mul_ps(v, _mm512_set1_ps(st->slope)));
+    return v;
+}
+
+/* vpdpbusd: 4 u8*s8 products summed straight into int32 */
+__attribute__((target("avx512f,avx512vnni")))
+static void int8_kernel_vnni_6x32(int k4, const signed char *a, const unsigned char *b, float *c, int ldc, const int8_store *st)
+{
+    __m512i c00 = _mm512_setzero_si512(), c01 = _mm512_setzero_si512();
+    __m512i c10 = _mm512_setzero_si512(), c11 = _mm512_setzero_si512();
+    __m512i c20 = _mm512_setzero_si512(), c21 = _mm512_setzero_si512();
+    __m512i c30 = _mm512_setzero_si512(), c31 = _mm512_setzero_si512();
+    __m512i c40 = _mm512_setzero_si512(), c41 = _mm512_setzero_si512();
+    __m512i c50 = _mm512_setzero_si512(), c51 = _mm512_setzero_si512();
+    __m512i ar;
+    int k;
+    for(k = 0; k < k4; ++k){
+        __m512i b0 = _mm512_loadu_si512(b);
+        __m512i b1 = _mm512_loadu_si512(b + 64);
+        VNNI_ROW(0) VNNI_ROW(1) VNNI_ROW(2) VNNI_ROW(3) VNNI_ROW(4) VNNI_ROW(5)
+        a += 24;
+        b += 128;
+    }
+    VNNI_STORE(0) VNNI_STORE(1) VNNI_STORE(2) VNNI_STORE(3) VNNI_STORE(4) VNNI_STORE(5)
+}
+
+#endif
+
+static const int8_kernel_info int8_kernels[] = {
+#ifdef INT8_X86
+    {{"vnni", "avx512f avx512vnni"}, 32, 127, int8_kernel_vnni_6x32},
+    {{"avx2", "avx2 fma"}, 16, 63, int8_kernel_avx2_6x16},
+#endif
+    {{"generic", ""}, 8, 127, int8_kernel_generic_6x8}
+};
+static cpu_kernel_table int8_kernel_table = CPU_KERNEL_TABLE(int8_kernels);
+
+static const int8_kernel_info *get_int8_kernel(void)
+{
+    return cpu_kernel_get(&int8_kernel_table);
+}
+
+/* forces a kernel ("vnni", "avx2", "generic") - returns 0 if not available on this cpu */
+int int8_set_kernel(const char *name)
+{
+    return cpu_kernel_set(&int8_kernel_table, name);
+}
+
+const char *int8_kernel_name(void)
+{
+    return get_int8_kernel()->cpu.name;
+}
+
+static int int8_k4(layer l)
+{
+    return (l.c*l.size*l.size + 3)/4;
+}
+
+static int int8_mpad(layer l)
+{
+    return (l.n + INT8_MR - 1)/INT8_MR*INT8_MR;
+}
+
+/* calibration: largest |input| of l seen so far */
+static float max_abs(const float *x, size_t n, float m)
+{
+    size_t i;
+    for(i = 0; i < n; ++i){
+        float v = fabs(x[i]);
+        if(v > m) m = v;
+    }
+    return m;
+}
+
+void update_int8_range(layer *l, const float *input)
+{
+    size_t n = (size_t)l->inputs*l->batch;
+    if(!l->upsample_src){
+        l->int8_range = max_abs(input, n, l->int8_range);
+        return;
+    }
+    /* the upsampled channels are not in input (memory_plan.c) - their largest |value| is that of upsample_src */
+    size_t plane = (size_t)l->h*l->w;
+    size_t c0 = l->upsample_c0*plane, c1 = c0 + l->upsample_c*plane;
+    float range = max_abs(input, c0, l->int8_range);
+    range = max_abs(input + c1, n - c1, range);
+    l->int8_range = max_abs(l->upsample_src, (c1 - c0)/(l->upsample_stride*l->upsample_stride), range);
+}
+
+/* quantized image, its im2col as byte rows & those rows packed in panels - still half of the fp32 im2col buffer */
+static size_t int8_image_size(layer l)
+{
+    return ((size_t)l.c*l.h*l.w + 63)/64*64;
+}
+
+static size_t int8_rows_size(layer l)
+{
+    return ((size_t)int8_k4(l)*4*l.out_h*l.out_w + 63)/64*64;
+}
+
+/* bytes */
+size_t get_int8_workspace_size(layer l)
+{
+    if(!l.int8) return 0;
+    size_t n = l.out_h*l.out_w;
+    return int8_image_size(l) + int8_rows_size(l) + (n + INT8_MAX_NR - 1)/INT8_MAX_NR*INT8_MAX_NR*int8_k4(l)*4;
+}
+
+static int int8_eligible(layer l)
+{
+    if(l.type != CONVOLUTIONAL || l.int8_range <= 0) return 0;
+    if(l.batch_normalize || l.binary || l.xnor || l.groups != 1 || l.blocked) return 0;
+    /* linear convolutions are the detection heads - kept in fp32, their outputs are boxes & scores directly */
+    if(l.activation == LINEAR) return 0;
+    /* darknet's 1x1 path reads its input as is, ignoring stride */
+    if(l.size == 1 && l.stride != 1) return 0;
+#ifdef GPU
+    if(gpu_index >= 0) return 0;
+#endif
+    return 1;
+}
+
+/* per filter symmetric quantization of l->weights, packed in INT8_MR row panels of 4 consecutive k */
+static void quantize_int8_weights(layer *l)
+{
+    const int K = l->c*l->size*l->size;
+    const int k4 = int8_k4(*l);
+    const int mpad = int8_mpad(*l);
+    int f, k;
+    free(l->int8_weights);
+    free(l->int8_scales);
+    free(l->int8_sums);
+    l->int8_weights = calloc((size_t)mpad*k4*4, sizeof(signed char));
+    l->int8_scales = calloc(mpad, sizeof(float));
+    l->int8_sums = calloc(mpad, sizeof(int));
+    float *expanded = l->half_weights ? calloc(K, sizeof(float)) : 0;
+    for(f = 0; f < l->n; ++f){
+        const float *w = expanded;
+        if(expanded) half_to_float_cpu((unsigned short *)l->weights + (size_t)f*K, K, expanded);
+        else w = l->weights + (size_t)f*K;
+        float max = 0;
+        for(k = 0; k < K; ++k){
+            if(fabs(w[k]) > max) max = fabs(w[k]);
+        }
+        float scale = max > 0 ? max/127 : 1;
+        signed char *dst = l->int8_weights + (size_t)(f/INT8_MR)*k4*4*INT8_MR + (f%INT8_MR)*4;
+        int sum = 0;
+        for(k = 0; k < K; ++k){
+            int q = (int)lrintf(w[k]/scale);
+            if(q > 127) q = 127;
+            if(q < -127) q = -127;
+            dst[(k/4)*4*INT8_MR + k%4] = q;
+            sum += q;
+        }
+        l->int8_scales[f] = scale;
+        l->int8_sums[f] = sum;
+    }
+    free(expanded);
+}
+
+/* every convolution with a calibrated range that int8 supports is quantized (others stay fp32) & net->int8 is set.
+   returns how many layers run int8 */
+int quantize_int8_network(network *net)
+{
+    int i, count = 0;
+    size_t workspace = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        if(!int8_eligible(*l)) continue;
+        quantize_int8_weights(l);
+        l->int8 = 1;
+        size_t s = get_int8_workspace_size(*l);
+        if(s > l->workspace_size) l->workspace_size = s;
+        if(l->workspace_size > workspace) workspace = l->workspace_size;
+        ++count;
+    }
+    if(workspace > net->workspace_size){
+        free(net->workspace);
+        net->workspace = calloc(1, workspace);
+        net->workspace_size = workspace;
+    }
+    net->int8 = count > 0;
+    return count;
+}
+
+/* calibration file: one "layer range" line per convolution */
+void save_int8_calibration(network *net, char *filename)
+{
+    int i;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    fprintf(fp, "int8 calibration %d\n", net->n);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL) fprintf(fp, "%d %g\n", i, l.int8_range);
+    }
+    fclose(fp);
+}
+
+/* reads ranges written by save_int8_calibration & quantizes net - returns layers running int8, 0 if the file
+   does not belong to a network of this depth */
+int load_int8_calibration(network *net, char *filename)
+{
+    int n, i;
+    float range;
+    FILE *fp = fopen(filename, "r");
+    if(!fp) file_error(filename);
+    if(fscanf(fp, "int8 calibration %d", &n) != 1 || n != net->n){
+        fprintf(stderr, "%s is not an int8 calibration of this network\n", filename);
+        fclose(fp);
+        return 0;
+    }
+    while(fscanf(fp, "%d %f", &i, &range) == 2){
+        if(i >= 0 && i < net->n && net->layers[i].type == CONVOLUTIONAL) net->layers[i].int8_range = range;
+    }
+    fclose(fp);
+    return quantize_int8_network(net);
+}
+
+/* x into xq + zp bytes */
+static void quantize_int8_input(const float *x, int n, float xscale, int qmax, unsigned char *dst)
+{
+    const float inv = 1/xscale;
+    const float zp = qmax + 1;
+    int i;
+    #pragma omp parallel for
+    for(i = 0; i < n; ++i){
+        float v = x[i]*inv;
+        v = v > qmax ? qmax : (v < -qmax ? -qmax : v);
+        dst[i] = (unsigned char)(v + zp + .5f);
+    }
+}
+
+/* im2col of the quantized image as byte rows (one per k, out_h*out_w long), padded with zp (quantized zero) */
+static void im2col_int8(layer l, const unsigned char *im, int zp, unsigned char *rows)
+{
+    const int K = l.c*l.size*l.size;
+    const int N = l.out_h*l.out_w;
+    const int s = l.stride;
+    int k;
+    #pragma omp parallel for
+    for(k = 0; k < int8_k4(l)*4; ++k){
+        unsigned char *row = rows + (size_t)k*N;
+        if(k >= K){
+            memset(row, zp, N);
+            continue;
+        }
+        const int kx = k % l.size;
+        const int ky = (k / l.size) % l.size;
+        const unsigned char *plane = im + (size_t)(k / l.size / l.size)*l.h*l.w;
+        /* output columns [lo, hi) read inside the image */
+        const int lo = l.pad - kx > 0 ? (l.pad - kx + s - 1)/s : 0;
+        const int last = l.w - 1 - kx + l.pad;
+        int hi = last < 0 ? 0 : last/s + 1;
+        int oy, ox;
+        if(hi > l.out_w) hi = l.out_w;
+        if(hi < lo) hi = lo;
+        for(oy = 0; oy < l.out_h; ++oy){
+            unsigned char *o = row + oy*l.out_w;
+            const int iy = oy*s + ky - l.pad;
+            if(iy < 0 || iy >= l.h){
+                memset(o, zp, l.out_w);
+                continue;
+            }
+            const unsigned char *src = plane + iy*l.w + kx - l.pad;
+            memset(o, zp, lo);
+            if(s == 1){
+                memcpy(o + lo, src + lo, hi - lo);
+            } else {
+                for(ox = lo; ox < hi; ++ox) o[ox] = src[ox*s];
+            }
+            memset(o + hi, zp, l.out_w - hi);
+        }
+    }
+}
+
+/* byte rows into nr column panels of 4 consecutive k (the vpdpbusd / pmaddubsw layout), padded with zp */
+static void pack_int8_input(layer l, const unsigned char *rows, int nr, int zp, unsigned char *dst)
+{
+    const int k4 = int8_k4(l);
+    const int N = l.out_h*l.out_w;
+    const int panels = (N + nr - 1)/nr;
+    int p;
+    #pragma omp parallel for
+    for(p = 0; p < panels; ++p){
+        const int n = N - p*nr < nr ? N - p*nr : nr;
+        int k, j;
+        for(k = 0; k < k4; ++k){
+            const unsigned char *r = rows + (size_t)4*k*N + p*nr;
+            unsigned char *d = dst + ((size_t)p*k4 + k)*4*nr;
+            for(j = 0; j < n; ++j){
+                d[4*j] = r[j];
+                d[4*j + 1] = r[N + j];
+                d[4*j + 2] = r[2*N + j];
+                d[4*j + 3] = r[3*N + j];
+            }
+            memset(d + 4*n, zp, 4*(nr - n));
+        }
+    }
+}
+
+static float int8_activation_slope(ACTIVATION a)
+{
+    if(a == LEAKY) return .1;
+    if(a == RELU) return 0;
+    return 1;
+}
+
+/* writes activation(conv + bias) of net.input to l.output with int8 weights & input */
+void forward_int8_convolution(layer l, network net)
+{
+    const int8_kernel_info *ki = get_int8_kernel();
+    const int mr = INT8_MR;
+    const int nr = ki->nr;
+    const int M = l.n;
+    const int N = l.out_h*l.out_w;
+    const int k4 = int8_k4(l);
+    const int zp = ki->qmax + 1;
+    const int fused_act = l.activation == LINEAR || l.activation == LEAKY || l.activation == RELU;
+    unsigned char *im = (unsigned char *)net.workspace;
+    unsigned char *rows = im + int8_image_size(l);
+    unsigned char *pb = rows + int8_rows_size(l);
+    int8_store st = {0, 0, 0, l.int8_range/ki->qmax, zp, fused_act ? int8_activation_slope(l.activation) : 1};
+    int b;
+
+    for(b = 0; b < l.batch; ++b){
+        float *out = l.output + (size_t)b*l.outputs;
+        quantize_int8_input(net.input + (size_t)b*l.inputs, l.inputs, st.xscale, ki->qmax, im);
+        im2col_int8(l, im, zp, rows);
+        pack_int8_input(l, rows, nr, zp, pb);
+
+        int mblocks = (M + INT8_MC - 1)/INT8_MC;
+        int nblocks = (N + INT8_NB - 1)/INT8_NB;
+        int t;
+        #pragma omp parallel for schedule(dynamic)
+        for(t = 0; t < mblocks*nblocks; ++t){
+            int i0 = (t / nblocks)*INT8_MC;
+            int j0 = (t % nblocks)*INT8_NB;
+            int i1 = i0 + INT8_MC < M ? i0 + INT8_MC : M;
+            int j1 = j0 + INT8_NB < N ? j0 + INT8_NB : N;
+            int ir, jr, r;
+            for(jr = j0; jr < j1; jr += nr){
+                const unsigned char *bp = pb + (size_t)(jr/nr)*k4*4*nr;
+                int n = j1 - jr < nr ? j1 - jr : nr;
+                for(ir = i0; ir < i1; ir += mr){
+                    const signed char *ap = l.int8_weights + (size_t)(ir/mr)*k4*4*mr;
+                    int m = i1 - ir < mr ? i1 - ir : mr;
+                    float *c = out + (size_t)ir*N + jr;
+                    int8_store tile = st;
+                    float bias[INT8_MR] = {0};
+                    for(r = 0; r < m; ++r) bias[r] = l.biases[ir + r];
+                    tile.sums = l.int8_sums + ir;
+                    tile.wscales = l.int8_scales + ir;
+                    tile.bias = bias;
+                    if(m == mr && n == nr){
+                        ki->kernel(k4, ap, bp, c, N, &tile);
+                    } else {
+                        /* edge tile - full tile into scratch, valid part copied out */
+                        float tmp[INT8_MR*INT8_MAX_NR];
+                        ki->kernel(k4, ap, bp, tmp, nr, &tile);
+                        for(r = 0; r < m; ++r) memcpy(c + (size_t)r*N, tmp + r*nr, n*sizeof(float));
+                    }
+                    if(!fused_act){
+                        for(r = 0; r < m; ++r) activate_array(c + (size_t)r*N, n, l.activation);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* times forward_convolutional_layer in fp32 & int8 on random input within the calibrated range for every int8
+   layer of net & reports the error int8 adds (relative to largest output) */
+void benchmark_int8_network(network *net, int iterations)
+{
+    int i;
+    double total_old = 0, total_new = 0;
+    if(iterations < 1) iterations = 1;
+    printf("int8 convolution benchmark, %d iteration(s) per layer, kernel: %s\n", iterations, int8_kernel_name());
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL || !l.int8) continue;
+
+        network state = *net;
+        state.int8 = 1;
+        layer fp32 = l;
+        fp32.int8 = 0;
+        conv_path_timing t = time_convolutional_paths(fp32, l, state, l.int8_range, iterations);
+        total_old += t.ref_time;
+        total_new += t.time;
+        printf("layer %3d  %2dx%d/%d %4d x%4d x%4d -> %4d | fp32 %9.3f ms | int8 %9.3f ms (x%.2f) | error %.1e\n",
+                i, l.size, l.size, l.stride, l.w, l.h, l.c, l.n, t.ref_time*1000, t.time*1000, t.ref_time/t.time, t.error);
+    }
+    printf("int8 layers total: fp32 %.3f ms, int8 %.3f ms\n", total_old*1000, total_new*1000);
+}
@@ -0,0 +1,10 @@
+#ifndef INT8_CONVOLUTION_H
+#define INT8_CONVOLUTION_H
+
+#include "darknet.h"
+
+void update_int8_range(layer *l, const float *input);
+size_t get_int8_workspace_size(layer l);
+void forward_int8_convolution(layer l, network net);
+
+#endif
@@ -33,6 +33,13 @@ void free_layer(layer l)
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
     if(l.weight_updates)     free(l.weight_updates);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.direct_weights)     free(l.direct_weights);
+    if(l.int8_weights)       free(l.int8_weights);
+    if(l.int8_scales)        free(l.int8_scales);
+    if(l.int8_sums)          free(l.int8_sums);
+    if(l.xnor_weights)       free(l.xnor_weights);
+    if(l.xnor_scales)        free(l.xnor_scales);
     if(l.delta)              free(l.delta);
     if(l.output)             free(l.output);
     if(l.squared)            free(l.squared);
@@ -1,6 +1,8 @@
 #include "maxpool_layer.h"
+#include "blocked_layout.h"
 #include "cuda.h"
 #include <stdio.h>
+#include <string.h>
 
 image get_maxpool_image(maxpool_layer l)
 {
@@ -18,7 +20,7 @@ image get_maxpool_delta(maxpool_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
-maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding)
+maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding, int train)
 {
     maxpool_layer l = {0};
     l.type = MAXPOOL;
@@ -35,9 +37,11 @@ maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int s
     l.size = size;
     l.stride = stride;
     int output_size = l.out_h * l.out_w * l.out_c * batch;
-    l.indexes = calloc(output_size, sizeof(int));
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if(train){
+        l.indexes = calloc(output_size, sizeof(int));
+        l.delta =   calloc(output_size, sizeof(float));
+    }
     l.forward = forward_maxpool_layer;
     l.backward = backward_maxpool_layer;
     #ifdef GPU
@@ -62,9 +66,11 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->outputs = l->out_w * l->out_h * l->c;
     int output_size = l->outputs * l->batch;
 
-    l->indexes = realloc(l->indexes, output_size * sizeof(int));
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if(l->delta){
+        l->indexes = realloc(l->indexes, output_size * sizeof(int));
+        l->delta = realloc(l->delta, output_size * sizeof(float));
+    }
 
     #ifdef GPU
     cuda_free((float *)l->indexes_gpu);
@@ -76,8 +82,43 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     #endif
 }
 
+/* NCHW16c input & output (blocked_layout.c): the BLOCKED_C channels of a pixel are one contiguous vector */
+static void forward_maxpool_layer_blocked(const maxpool_layer l, network net)
+{
+    int b, cb, i, j, k, m, n;
+    const int offset = -l.pad/2;
+    const int blocks = l.c/BLOCKED_C;
+    for(b = 0; b < l.batch; ++b){
+        for(cb = 0; cb < blocks; ++cb){
+            const float *in = net.input + ((size_t)b*blocks + cb)*l.h*l.w*BLOCKED_C;
+            float *out = l.output + ((size_t)b*blocks + cb)*l.out_h*l.out_w*BLOCKED_C;
+            for(i = 0; i < l.out_h; ++i){
+                for(j = 0; j < l.out_w; ++j){
+                    float max[BLOCKED_C];
+                    for(k = 0; k < BLOCKED_C; ++k) max[k] = -FLT_MAX;
+                    for(n = 0; n < l.size; ++n){
+                        int y = offset + i*l.stride + n;
+                        if(y < 0 || y >= l.h) continue;
+                        for(m = 0; m < l.size; ++m){
+                            int x = offset + j*l.stride + m;
+                            if(x < 0 || x >= l.w) continue;
+                            const float *v = in + ((size_t)y*l.w + x)*BLOCKED_C;
+                            for(k = 0; k < BLOCKED_C; ++k) max[k] = v[k] > max[k] ? v[k] : max[k];
+                        }
+                    }
+                    memcpy(out + ((size_t)i*l.out_w + j)*BLOCKED_C, max, sizeof(max));
+                }
+            }
+        }
+    }
+}
+
 void forward_maxpool_layer(const maxpool_layer l, network net)
 {
+    if(l.blocked){
+        forward_maxpool_layer_blocked(l, net);
+        return;
+    }
     int b,i,j,k,m,n;
     int w_offset = -l.pad/2;
     int h_offset = -l.pad/2;
@@ -106,7 +147,7 @@ void forward_maxpool_layer(const maxpool_layer l, network net)
                         }
                     }
                     l.output[out_index] = max;
-                    l.indexes[out_index] = max_i;
+                    if(l.indexes) l.indexes[out_index] = max_i;
                 }
             }
         }
@@ -0,0 +1,230 @@
+#include "memory_plan.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Inference only activation memory planner: instead of every layer owning its output for the whole network lifetime,
+   outputs are placed in slots of one arena. a layer's output is live from its own forward until the last layer
+   reading it (the next layer, route / shortcut layers naming it) - yolo layers & the network output stay live to the
+   end since they are read after forward. slots are handed out in layer order, a slot is free again once its
+   occupant is dead, and a new output takes the smallest free slot it fits in (else the largest free one grows).
+
+   with batch 1 the layers a route concatenates write straight into their slice of its output (the route copies
+   nothing), so a route & its inputs share one slot for the union of their lifetimes. an upsample whose only reader
+   is such a route, read only by a 1x1 convolution, is not written at all - the convolution reads those channels as
+   a strided view of the upsample input while packing them for its gemm (gemm_upsample_rows). */
+
+#define MEMORY_PLAN_ALIGN 16 /* floats - slots start on 64 byte boundaries */
+
+/* every forward of these writes all of l.output without reading it first & keeps no pointer into other outputs */
+static int memory_plan_supported(layer l)
+{
+    return l.type == CONVOLUTIONAL || l.type == MAXPOOL || l.type == ROUTE || l.type == SHORTCUT ||
+        l.type == UPSAMPLE || l.type == YOLO;
+}
+
+static void memory_plan_read(int *last_use, int *readers, int layer, int by)
+{
+    if(last_use[layer] < by) last_use[layer] = by;
+    ++readers[layer];
+}
+
+/* index of the last layer that reads output of each layer (net->n = read after forward) & how many layers read it */
+static void memory_plan_last_use(network *net, int *last_use, int *readers)
+{
+    int i, j;
+    const layer out = get_network_output_layer(net);
+    for(i = 0; i < net->n; ++i) last_use[i] = i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == YOLO || l.output == out.output) memory_plan_read(last_use, readers, i, net->n);
+        if(l.type == ROUTE){
+            /* route reads the layers it names, not net.input */
+            for(j = 0; j < l.n; ++j) memory_plan_read(last_use, readers, l.input_layers[j], i);
+            continue;
+        }
+        if(l.type == SHORTCUT) memory_plan_read(last_use, readers, l.index, i);
+        if(i > 0) memory_plan_read(last_use, readers, i-1, i);
+    }
+}
+
+/* parent[i] = route whose output holds output of layer i at offset[i] floats, -1 = own slot */
+static void memory_plan_routes(network *net, int *parent, size_t *offset)
+{
+    int i, j;
+    const layer out = get_network_output_layer(net);
+    for(i = 0; i < net->n; ++i) parent[i] = -1;
+    if(net->batch != 1) return;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        size_t o = 0;
+        if(l.type != ROUTE) continue;
+        for(j = 0; j < l.n; ++j){
+            int in = l.input_layers[j];
+            layer p = net->layers[in];
+            /* each layer can sit in one route only, & outputs read after forward stay apart */
+            if(parent[in] < 0 && p.type != YOLO && p.output != out.output){
+                parent[in] = i;
+                offset[in] = o;
+            }
+            o += l.input_sizes[j];
+        }
+    }
+}
+
+/* upsample -> route -> 1x1 convolution: the convolution reads the upsample input through gemm_upsample_rows */
+static int memory_plan_upsample_view(network *net, int u, const int *parent, const int *readers)
+{
+    if(u < 1 || u + 2 >= net->n) return 0;
+    layer l = net->layers[u];
+    layer r = net->layers[u+1];
+    layer c = net->layers[u+2];
+    if(l.type != UPSAMPLE || l.reverse || l.scale != 1 || readers[u] != 1 || parent[u] != u + 1) return 0;
+    if(r.type != ROUTE || readers[u+1] != 1) return 0;
+    return c.type == CONVOLUTIONAL && c.size == 1 && c.stride == 1 && c.groups == 1 && !c.xnor && !c.binary && !c.blocked &&
+        c.w == l.out_w && c.h == l.out_h;
+}
+
+static size_t memory_plan_size(layer l)
+{
+    return ((size_t)l.outputs*l.batch + MEMORY_PLAN_ALIGN - 1)/MEMORY_PLAN_ALIGN*MEMORY_PLAN_ALIGN;
+}
+
+static size_t memory_plan(network *net, int verbose)
+{
+    int i, s;
+    if(!net->inference) return 0;
+#ifdef GPU
+    if(gpu_index >= 0) return 0;
+#endif
+    for(i = 0; i < net->n; ++i){
+        if(!memory_plan_supported(net->layers[i])) return 0;
+    }
+    unplan_network_memory(net);
+
+    int *last_use = calloc(net->n, sizeof(int));
+    int *readers = calloc(net->n, sizeof(int));
+    int *parent = calloc(net->n, sizeof(int));
+    int *root = calloc(net->n, sizeof(int));
+    int *first = calloc(net->n, sizeof(int));      /* of each root: first member to write */
+    int *view = calloc(net->n, sizeof(int));
+    size_t *root_offset = calloc(net->n, sizeof(size_t));
+    int *slot_of = calloc(net->n, sizeof(int));
+    int *occupant = calloc(net->n, sizeof(int));   /* root in each slot, -1 = free */
+    size_t *slot_size = calloc(net->n, sizeof(size_t));
+    int slots = 0, views = 0;
+    size_t before = 0;
+    memory_plan_last_use(net, last_use, readers);
+    memory_plan_routes(net, parent, root_offset);
+
+    for(i = 0; i < net->n; ++i){
+        view[i] = memory_plan_upsample_view(net, i, parent, readers);
+        /* the convolution reads the upsample input, which must live until then */
+        if(view[i] && last_use[i-1] < i + 2) last_use[i-1] = i + 2;
+        views += view[i];
+    }
+    /* a route group lives from its first member's forward to the last read of any member */
+    for(i = net->n - 1; i >= 0; --i){
+        int p = parent[i];
+        root[i] = p < 0 ? i : root[p];
+        if(p >= 0) root_offset[i] += root_offset[p];
+        first[i] = i;
+    }
+    for(i = 0; i < net->n; ++i){
+        int r = root[i];
+        if(first[r] > i) first[r] = i;
+        if(last_use[r] < last_use[i]) last_use[r] = last_use[i];
+    }
+
+    for(i = 0; i < net->n; ++i){
+        before += (size_t)net->layers[i].outputs*net->layers[i].batch*sizeof(float);
+    }
+    for(i = 0; i < net->n; ++i){
+        int r = root[i];
+        if(first[r] != i) continue;
+        size_t need = memory_plan_size(net->layers[r]);
+        int best = -1, largest = -1;
+        for(s = 0; s < slots; ++s){
+            if(occupant[s] >= 0 && last_use[occupant[s]] < i) occupant[s] = -1;
+            if(occupant[s] >= 0) continue;
+            if(slot_size[s] >= need && (best < 0 || slot_size[s] < slot_size[best])) best = s;
+            if(largest < 0 || slot_size[s] > slot_size[largest]) largest = s;
+        }
+        if(best < 0) best = largest;
+        if(best < 0) best = slots++;
+        if(slot_size[best] < need) slot_size[best] = need;
+        occupant[best] = r;
+        slot_of[r] = best;
+    }
+
+    size_t *offset = calloc(slots + 1, sizeof(size_t));
+    for(s = 0; s < slots; ++s) offset[s+1] = offset[s] + slot_size[s];
+    net->activation_arena = calloc(offset[slots], sizeof(float));
+    net->activation_arena_size = offset[slots]*sizeof(float);
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        free(l->output);
+        l->output = net->activation_arena + offset[slot_of[root[i]]] + root_offset[i];
+    }
+    for(i = 0; i < net->n; ++i){
+        if(!view[i]) continue;
+        layer *c = &net->layers[i+2];
+        net->layers[i].view_only = 1;
+        c->upsample_src = net->layers[i-1].output;
+        c->upsample_c0 = root_offset[i] - root_offset[i+1];
+        c->upsample_c0 /= c->w*c->h;
+        c->upsample_c = net->layers[i].out_c;
+        c->upsample_stride = net->layers[i].stride;
+    }
+    net->output = get_network_output_layer(net).output;
+
+    if(verbose){
+        int routed = 0;
+        for(i = 0; i < net->n; ++i) routed += parent[i] >= 0;
+        fprintf(stderr, "Activation memory: %.1f MB in %d layer outputs -> %.1f MB in %d slots "
+                "(%d route inputs in place, %d upsamples read as views)\n",
+                before/1048576., net->n, net->activation_arena_size/1048576., slots, routed, views);
+    }
+    free(offset);
+    free(last_use);
+    free(readers);
+    free(parent);
+    free(root);
+    free(first);
+    free(view);
+    free(root_offset);
+    free(slot_of);
+    free(occupant);
+    free(slot_size);
+    return net->activation_arena_size;
+}
+
+/* places every layer output of an inference network (parse_network_cfg_custom) in a shared arena & prints memory
+   before / after. returns arena bytes, 0 if the network is not planned (training state or unsupported layers) */
+size_t plan_network_memory(network *net)
+{
+    return memory_plan(net, 1);
+}
+
+/* plan again for new layer sizes - resize_network */
+void replan_network_memory(network *net)
+{
+    memory_plan(net, 0);
+}
+
+/* gives every layer its own zeroed output again - resize / free can then realloc & free them one by one */
+void unplan_network_memory(network *net)
+{
+    int i;
+    if(!net->activation_arena) return;
+    for(i = 0; i < net->n; ++i){
+        layer *l = &net->layers[i];
+        l->output = calloc((size_t)l->outputs*l->batch, sizeof(float));
+        l->view_only = 0;
+        l->upsample_src = 0;
+    }
+    net->output = get_network_output_layer(net).output;
+    free(net->activation_arena);
+    net->activation_arena = 0;
+    net->activation_arena_size = 0;
+}
@@ -0,0 +1,9 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include "darknet.h"
+
+void replan_network_memory(network *net);
+void unplan_network_memory(network *net);
+
+#endif
@@ -14,6 +14,8 @@
 #include "crnn_layer.h"
 #include "local_layer.h"
 #include "convolutional_layer.h"
+#include "int8_convolution.h"
+#include "memory_plan.h"
 #include "activation_layer.h"
 #include "detection_layer.h"
 #include "region_layer.h"
@@ -60,6 +62,17 @@ network *load_network(char *cfg, char *weights, int clear)
     return net;
 }
 
+/* load_network with parse_network_cfg_custom - inference = 1 allocates no training buffers */
+network *load_network_custom(char *cfg, char *weights, int clear, int inference)
+{
+    network *net = parse_network_cfg_custom(cfg, inference);
+    if(weights && weights[0] != 0){
+        load_weights(net, weights);
+    }
+    if(clear) (*net->seen) = 0;
+    return net;
+}
+
 size_t get_current_batch(network *net)
 {
     size_t batch_num = (*net->seen)/(net->batch*net->subdivisions);
@@ -168,6 +181,8 @@ char *get_layer_string(LAYER_TYPE a)
             return "normalization";
         case BATCHNORM:
             return "batchnorm";
+        case UPSAMPLE:
+            return "upsample";
         default:
             break;
     }
@@ -185,6 +200,25 @@ network *make_network(int n)
     return net;
 }
 
+/* direct layers size no im2col buffer - grow workspace the first time the network is trained on cpu */
+static void reserve_train_workspace(network *net)
+{
+    size_t size = 0;
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == CONVOLUTIONAL && l.direct){
+            size_t s = get_convolutional_train_workspace_size(l);
+            if(s > size) size = s;
+        }
+    }
+    if(size > net->workspace_size){
+        free(net->workspace);
+        net->workspace = calloc(1, size);
+        net->workspace_size = size;
+    }
+}
+
 void forward_network(network *netp)
 {
 #ifdef GPU
@@ -193,6 +227,7 @@ void forward_network(network *netp)
         return;
     }
 #endif
+    if(netp->train) reserve_train_workspace(netp);
     network net = *netp;
     int i;
     for(i = 0; i < net.n; ++i){
@@ -201,12 +236,16 @@ void forward_network(network *netp)
         if(l.delta){
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
+        if(net.int8_calibrate && l.type == CONVOLUTIONAL) update_int8_range(&netp->layers[i], net.input);
+        double t = net.layer_time ? what_time_is_it_now() : 0;
         l.forward(l, net);
+        if(net.layer_time) net.layer_time[i] += what_time_is_it_now() - t;
         net.input = l.output;
         if(l.truth) {
             net.truth = l.output;
         }
     }
+    if(net.layer_time) ++net.layer_time[net.n];
     calc_network_cost(netp);
 }
 
@@ -288,6 +327,7 @@ void backward_network(network *netp)
 
 float train_network_datum(network *net)
 {
+    if(net->inference) error("Can't train a network built for inference only");
     *net->seen += net->batch;
     net->train = 1;
     forward_network(net);
@@ -362,7 +402,9 @@ int resize_network(network *net, int w, int h)
     cuda_free(net->workspace);
 #endif
     int i;
+    int planned = net->activation_arena != 0;
     //if(w == net->w && h == net->h) return 0;
+    unplan_network_memory(net);
     net->w = w;
     net->h = h;
     int inputs = 0;
@@ -428,11 +470,14 @@ int resize_network(network *net, int w, int h)
     }else {
         free(net->workspace);
         net->workspace = calloc(1, workspace_size);
+        net->workspace_size = workspace_size;
     }
 #else
     free(net->workspace);
     net->workspace = calloc(1, workspace_size);
+    net->workspace_size = workspace_size;
 #endif
+    if(planned) replan_network_memory(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -507,28 +552,31 @@ float *network_predict(network *net, float *input)
     return out;
 }
 
+static int layer_num_detections(layer l, float thresh)
+{
+    if(l.type == YOLO){
+        return yolo_num_detections(l, thresh);
+    }
+    if(l.type == DETECTION || l.type == REGION){
+        return l.w*l.h*l.n;
+    }
+    return 0;
+}
+
 int num_detections(network *net, float thresh)
 {
     int i;
     int s = 0;
     for(i = 0; i < net->n; ++i){
-        layer l = net->layers[i];
-        if(l.type == YOLO){
-            s += yolo_num_detections(l, thresh);
-        }
-        if(l.type == DETECTION || l.type == REGION){
-            s += l.w*l.h*l.n;
-        }
+        s += layer_num_detections(net->layers[i], thresh);
     }
     return s;
 }
 
-detection *make_network_boxes(network *net, float thresh, int *num)
+static detection *make_boxes(network *net, int nboxes)
 {
     layer l = net->layers[net->n - 1];
     int i;
-    int nboxes = num_detections(net, thresh);
-    if(num) *num = nboxes;
     detection *dets = calloc(nboxes, sizeof(detection));
     for(i = 0; i < nboxes; ++i){
         dets[i].prob = calloc(l.classes, sizeof(float));
@@ -539,23 +587,36 @@ detection *make_network_boxes(network *net, float thresh, int *num)
     return dets;
 }
 
+detection *make_network_boxes(network *net, float thresh, int *num)
+{
+    int nboxes = num_detections(net, thresh);
+    if(num) *num = nboxes;
+    return make_boxes(net, nboxes);
+}
+
+/* fills boxes of a single output layer - returns where the next layer's boxes start */
+static detection *fill_layer_boxes(network *net, layer l, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
+{
+    if(l.type == YOLO){
+        int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets);
+        dets += count;
+    }
+    if(l.type == REGION){
+        get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets);
+        dets += l.w*l.h*l.n;
+    }
+    if(l.type == DETECTION){
+        get_detection_detections(l, w, h, thresh, dets);
+        dets += l.w*l.h*l.n;
+    }
+    return dets;
+}
+
 void fill_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets)
 {
     int j;
     for(j = 0; j < net->n; ++j){
-        layer l = net->layers[j];
-        if(l.type == YOLO){
-            int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets);
-            dets += count;
-        }
-        if(l.type == REGION){
-            get_region_detections(l, w, h, net->w, net->h, thresh, map, hier, relative, dets);
-            dets += l.w*l.h*l.n;
-        }
-        if(l.type == DETECTION){
-            get_detection_detections(l, w, h, thresh, dets);
-            dets += l.w*l.h*l.n;
-        }
+        dets = fill_layer_boxes(net, net->layers[j], w, h, thresh, hier, map, relative, dets);
     }
 }
 
@@ -566,6 +627,143 @@ detection *get_network_boxes(network *net, int w, int h, float thresh, float hie
     return dets;
 }
 
+/* view of a single image b of a batched forward pass - detection functions only read output of batch 0 */
+static layer batch_item_layer(layer l, int b)
+{
+    l.output += b*l.outputs;
+    l.batch = 1;
+    return l;
+}
+
+int num_detections_batch(network *net, float thresh, int b)
+{
+    int i;
+    int s = 0;
+    for(i = 0; i < net->n; ++i){
+        s += layer_num_detections(batch_item_layer(net->layers[i], b), thresh);
+    }
+    return s;
+}
+
+detection *get_network_boxes_batch(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num)
+{
+    int nboxes = num_detections_batch(net, thresh, b);
+    if(num) *num = nboxes;
+    detection *dets = make_boxes(net, nboxes);
+    detection *d = dets;
+    int j;
+    for(j = 0; j < net->n; ++j){
+        d = fill_layer_boxes(net, batch_item_layer(net->layers[j], b), w, h, thresh, hier, map, relative, d);
+    }
+    return dets;
+}
+
+/* same as get_network_boxes_batch, but boxes & their prob/mask arrays come from pool, which only grows.
+   boxes are valid until next call with same pool - do not free_detections them */
+detection *get_network_boxes_pool(network *net, int b, int w, int h, float thresh, float hier, int *map, int relative, int *num, detection_pool *pool)
+{
+    layer l = net->layers[net->n - 1];
+    int nboxes = num_detections_batch(net, thresh, b);
+    if(num) *num = nboxes;
+    if(nboxes > pool->size){
+        int size = nboxes > 2*pool->size ? nboxes : 2*pool->size;
+        pool->dets = realloc(pool->dets, size*sizeof(detection));
+        pool->prob = realloc(pool->prob, size*l.classes*sizeof(float));
+        if(l.coords > 4) pool->mask = realloc(pool->mask, size*(l.coords-4)*sizeof(float));
+        pool->size = size;
+    }
+    memset(pool->dets, 0, nboxes*sizeof(detection));
+    memset(pool->prob, 0, nboxes*l.classes*sizeof(float));
+    int i;
+    for(i = 0; i < nboxes; ++i){
+        pool->dets[i].prob = pool->prob + i*l.classes;
+        if(l.coords > 4) pool->dets[i].mask = pool->mask + i*(l.coords-4);
+    }
+    detection *d = pool->dets;
+    int j;
+    for(j = 0; j < net->n; ++j){
+        d = fill_layer_boxes(net, batch_item_layer(net->layers[j], b), w, h, thresh, hier, map, relative, d);
+    }
+    return pool->dets;
+}
+
+void free_detection_pool(detection_pool *pool)
+{
+    free(pool->dets);
+    free(pool->prob);
+    free(pool->mask);
+    pool->dets = 0;
+    pool->prob = 0;
+    pool->mask = 0;
+    pool->size = 0;
+}
+
+static int is_detection_layer(layer l)
+{
+    return l.type == YOLO || l.type == REGION || l.type == DETECTION;
+}
+
+/* number of floats needed to save the outputs of all detection layers (batch 0) */
+int detection_outputs_size(network *net)
+{
+    int i;
+    int s = 0;
+    for(i = 0; i < net->n; ++i){
+        if(is_detection_layer(net->layers[i])) s += net->layers[i].outputs;
+    }
+    return s;
+}
+
+/* copies outputs of detection layers so the network can run the next frame before boxes are extracted */
+void save_detection_outputs(network *net, float *dst)
+{
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(is_detection_layer(l)){
+            memcpy(dst, l.output, l.outputs*sizeof(float));
+            dst += l.outputs;
+        }
+    }
+}
+
+/* same as get_network_boxes, but reads outputs saved with save_detection_outputs. does not touch layer output buffers */
+detection *get_network_boxes_saved(network *net, float *saved, int w, int h, float thresh, float hier, int *map, int relative, int *num)
+{
+    int i;
+    int nboxes = 0;
+    float *out = saved;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!is_detection_layer(l)) continue;
+        l.output = out;
+        l.batch = 1;
+        nboxes += layer_num_detections(l, thresh);
+        out += l.outputs;
+    }
+    if(num) *num = nboxes;
+    detection *dets = make_boxes(net, nboxes);
+    detection *d = dets;
+    out = saved;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(!is_detection_layer(l)) continue;
+        l.output = out;
+        l.batch = 1;
+        d = fill_layer_boxes(net, l, w, h, thresh, hier, map, relative, d);
+        out += l.outputs;
+    }
+    return dets;
+}
+
+/* changes batch size and reallocates all layer buffers for it */
+void resize_batch_network(network *net, int b)
+{
+    if(net->batch == b) return;
+    set_batch_network(net, b);
+    resize_network(net, net->w, net->h);
+}
+
 void free_detections(detection *dets, int n)
 {
     int i;
@@ -716,6 +914,8 @@ float network_accuracy_multi(network *net, data d, int n)
 void free_network(network *net)
 {
     int i;
+    unplan_network_memory(net);
+    free(net->layer_time);
     for(i = 0; i < net->n; ++i){
         free_layer(net->layers[i]);
     }
@@ -775,7 +975,14 @@ void forward_network_gpu(network *netp)
         if(l.delta_gpu){
             fill_gpu(l.outputs * l.batch, 0, l.delta_gpu, 1);
         }
+        /* kernels run asynchronously - profiling waits for the previous layer before starting the clock */
+        if(net.layer_time) cudaDeviceSynchronize();
+        double t = net.layer_time ? what_time_is_it_now() : 0;
         l.forward_gpu(l, net);
+        if(net.layer_time){
+            cudaDeviceSynchronize();
+            net.layer_time[i] += what_time_is_it_now() - t;
+        }
         net.input_gpu = l.output_gpu;
         net.input = l.output;
         if(l.truth) {
@@ -783,6 +990,7 @@ void forward_network_gpu(network *netp)
             net.truth = l.output;
         }
     }
+    if(net.layer_time) ++net.layer_time[net.n];
     pull_network_output(netp);
     calc_network_cost(netp);
 }
@@ -36,6 +36,9 @@
 #include "softmax_layer.h"
 #include "lstm_layer.h"
 #include "utils.h"
+#include "winograd.h"
+#include "direct_convolution.h"
+#include "xnor_convolution.h"
 
 typedef struct{
     char *type;
@@ -199,9 +202,12 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int binary = option_find_int_quiet(options, "binary", 0);
     int xnor = option_find_int_quiet(options, "xnor", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,groups,size,stride,padding,activation, batch_normalize, binary, xnor, params.net->adam, !params.net->inference);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
+    setup_winograd_convolution(&layer, option_find_int_quiet(options, "winograd", params.net->winograd));
+    setup_direct_convolution(&layer, option_find_int_quiet(options, "direct", params.net->direct));
+    setup_xnor_convolution(&layer);
 
     return layer;
 }
@@ -311,7 +317,7 @@ layer parse_yolo(list *options, size_params params)
 
     char *a = option_find_str(options, "mask", 0);
     int *mask = parse_yolo_mask(a, &num);
-    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes);
+    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes, !params.net->inference);
     assert(l.outputs == params.inputs);
 
     l.max_boxes = option_find_int_quiet(options, "max",90);
@@ -493,7 +499,7 @@ maxpool_layer parse_maxpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before maxpool layer must output image.");
 
-    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding);
+    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding,!params.net->inference);
     return layer;
 }
 
@@ -532,7 +538,7 @@ layer parse_normalization(list *options, size_params params)
 
 layer parse_batchnorm(list *options, size_params params)
 {
-    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c);
+    layer l = make_batchnorm_layer(params.batch, params.w, params.h, params.c, !params.net->inference);
     return l;
 }
 
@@ -545,7 +551,7 @@ layer parse_shortcut(list *options, size_params params, network *net)
     int batch = params.batch;
     layer from = net->layers[index];
 
-    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c);
+    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c, !params.net->inference);
 
     char *activation_s = option_find_str(options, "activation", "linear");
     ACTIVATION activation = get_activation(activation_s);
@@ -593,7 +599,7 @@ layer parse_upsample(list *options, size_params params, network *net)
 {
 
     int stride = option_find_int(options, "stride",2);
-    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride);
+    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride, !params.net->inference);
     l.scale = option_find_float_quiet(options, "scale", 1);
     return l;
 }
@@ -620,7 +626,7 @@ route_layer parse_route(list *options, size_params params, network *net)
     }
     int batch = params.batch;
 
-    route_layer layer = make_route_layer(batch, n, layers, sizes);
+    route_layer layer = make_route_layer(batch, n, layers, sizes, !params.net->inference);
 
     convolutional_layer first = net->layers[layers[0]];
     layer.out_w = first.out_w;
@@ -683,6 +689,15 @@ void parse_net_options(list *options, network *net)
     net->min_ratio = option_find_float_quiet(options, "min_ratio", (float) net->min_crop / net->w);
     net->center = option_find_int_quiet(options, "center",0);
     net->clip = option_find_float_quiet(options, "clip", 0);
+    /* training re-transforms weights after every update - only inference networks use winograd unless asked for */
+    net->winograd = option_find_int_quiet(options, "winograd", net->inference ? 4 : 0);
+    /* same for direct - trainable networks keep im2col, which also needs no reserve_train_workspace */
+    net->direct = option_find_int_quiet(options, "direct", net->inference);
+    net->fold_batchnorm = option_find_int_quiet(options, "fold_batchnorm", 0);
+    net->half_weights = option_find_int_quiet(options, "half_weights", 0);
+    /* experimental: yolo heads still convert back to NCHW, and on the cpus measured so far the blocked forward is
+       slower than the default layout - kept for further work, not for speed */
+    net->blocked_layout = option_find_int_quiet(options, "blocked_layout", 0);
 
     net->angle = option_find_float_quiet(options, "angle", 0);
     net->aspect = option_find_float_quiet(options, "aspect", 1);
@@ -740,6 +755,13 @@ int is_network(section *s)
 }
 
 network *parse_network_cfg(char *filename)
+{
+    return parse_network_cfg_custom(filename, 0);
+}
+
+/* inference = 1 builds the network without training state: layers get no deltas, weight / bias / scale updates,
+   batchnorm x, x_norm & delta buffers or adam moments. such a network can only run forward */
+network *parse_network_cfg_custom(char *filename, int inference)
 {
     list *sections = read_cfg(filename);
     node *n = sections->front;
@@ -751,6 +773,7 @@ network *parse_network_cfg(char *filename)
     section *s = (section *)n->val;
     list *options = s->options;
     if(!is_network(s)) error("First section must be [net] or [network]");
+    net->inference = inference;
     parse_net_options(options, net);
 
     params.h = net->h;
@@ -880,11 +903,14 @@ network *parse_network_cfg(char *filename)
             net->workspace = cuda_make_array(0, (workspace_size-1)/sizeof(float)+1);
         }else {
             net->workspace = calloc(1, workspace_size);
+            net->workspace_size = workspace_size;
         }
 #else
         net->workspace = calloc(1, workspace_size);
+        net->workspace_size = workspace_size;
 #endif
     }
+    if(net->blocked_layout) block_network_layout(net);
     return net;
 }
 
@@ -972,8 +998,27 @@ void save_convolutional_weights(layer l, FILE *fp)
         fwrite(l.scales, sizeof(float), l.n, fp);
         fwrite(l.rolling_mean, sizeof(float), l.n, fp);
         fwrite(l.rolling_variance, sizeof(float), l.n, fp);
+    } else if (l.batchnorm_folded){
+        /* the cfg still says batch_normalize=1 - write a batchnorm that does nothing so the file loads either way.
+           scale 1.000001 cancels the epsilon normalize_cpu adds to sqrt(variance) = 1 */
+        float *identity = calloc(l.n, sizeof(float));
+        int i;
+        for(i = 0; i < l.n; ++i) identity[i] = 1.000001f;
+        fwrite(identity, sizeof(float), l.n, fp);
+        for(i = 0; i < l.n; ++i) identity[i] = 0;
+        fwrite(identity, sizeof(float), l.n, fp);
+        for(i = 0; i < l.n; ++i) identity[i] = 1;
+        fwrite(identity, sizeof(float), l.n, fp);
+        free(identity);
+    }
+    if(l.half_weights){
+        float *weights = calloc(num, sizeof(float));
+        half_to_float_cpu((unsigned short *)l.weights, num, weights);
+        fwrite(weights, sizeof(float), num, fp);
+        free(weights);
+    } else {
+        fwrite(l.weights, sizeof(float), num, fp);
     }
-    fwrite(l.weights, sizeof(float), num, fp);
 }
 
 void save_batchnorm_weights(layer l, FILE *fp)
@@ -1163,6 +1208,7 @@ void load_convolutional_weights_binary(layer l, FILE *fp)
 
 void load_convolutional_weights(layer l, FILE *fp)
 {
+    if(l.half_weights) error("Can't load weights into fp16 convolution");
     if(l.binary){
         //load_convolutional_weights_binary(l, fp);
         //return;
@@ -1207,6 +1253,9 @@ void load_convolutional_weights(layer l, FILE *fp)
         transpose_matrix(l.weights, l.c*l.size*l.size, l.n);
     }
     //if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
+    transform_winograd_weights(l);
+    transform_direct_weights(l);
+    transform_xnor_weights(l);
 #ifdef GPU
     if(gpu_index >= 0){
         push_convolutional_layer(l);
@@ -1248,6 +1297,8 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff)
         if (l.dontload) continue;
         if(l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL){
             load_convolutional_weights(l, fp);
+            if(l.type == CONVOLUTIONAL && net->fold_batchnorm) fold_batchnorm_convolutional_layer(&net->layers[i]);
+            if(l.type == CONVOLUTIONAL && net->half_weights) half_convolutional_weights(&net->layers[i]);
         }
         if(l.type == CONNECTED){
             load_connected_weights(l, fp, transpose);
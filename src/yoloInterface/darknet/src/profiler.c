@@ -0,0 +1,159 @@
+#include "network.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Opt-in per layer profile of forward passes: with net->layer_time set, forward_network adds the wall time of
+   every layer to it & counts forward passes in layer_time[n] (network_predict restores the network struct, so the
+   count can not live in it). FLOPs & bytes are worked out from layer shapes afterwards, so profiling costs two clock
+   reads per layer on the cpu. on the gpu each layer is also synchronized, which removes the overlap between
+   kernel launches of consecutive layers - totals come out somewhat above an unprofiled pass.
+
+   FLOPs: 2 x multiply-adds for convolutions / connected layers, window size per output for pooling, one per output
+   element for the rest, 0 for pure copies (route, upsample). bytes: input read + output written + weights read, in
+   the precision they are stored in. copies the memory planner removed (route inputs in place, upsample views) are
+   not counted. */
+
+static double profile_flops(layer l)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+            return 2.0*l.n*l.size*l.size*l.c/l.groups*l.out_h*l.out_w;
+        case CONNECTED:
+            return 2.0*l.inputs*l.outputs;
+        case MAXPOOL:
+            return (double)l.size*l.size*l.outputs;
+        case AVGPOOL:
+            return l.inputs;
+        case ROUTE:
+        case UPSAMPLE:
+            return 0;
+        default:
+            return l.outputs;
+    }
+}
+
+static double profile_weight_bytes(layer l)
+{
+    if(l.type == CONVOLUTIONAL){
+        double w = l.xnor_weights ? 1./8 : l.int8 ? 1 : l.half_weights ? 2 : 4;
+        return w*l.nweights + 4.0*l.n;
+    }
+    if(l.type == CONNECTED) return 4.0*l.inputs*l.outputs + 4.0*l.outputs;
+    return 0;
+}
+
+static double profile_bytes(network *net, int index)
+{
+    layer l = net->layers[index];
+    int i;
+    if(l.type == UPSAMPLE && l.view_only) return 0;
+    if(l.type == ROUTE){
+        /* only inputs not already in their slice are copied */
+        double b = 0, offset = 0;
+        for(i = 0; i < l.n; ++i){
+            layer in = net->layers[l.input_layers[i]];
+            if(!(l.batch == 1 && in.output == l.output + (size_t)offset)) b += 8.0*l.input_sizes[i];
+            offset += l.input_sizes[i];
+        }
+        return b;
+    }
+    double in = l.inputs;
+    if(l.type == SHORTCUT) in += l.outputs;
+    if(l.type == CONVOLUTIONAL && l.upsample_src) in -= (double)l.upsample_c*l.h*l.w*(1 - 1.0/(l.upsample_stride*l.upsample_stride));
+    return 4.0*(in + l.outputs) + profile_weight_bytes(l);
+}
+
+/* enable = 1 starts recording (from zero), 0 stops & drops the profile */
+void profile_network(network *net, int enable)
+{
+    free(net->layer_time);
+    net->layer_time = enable ? calloc(net->n + 1, sizeof(double)) : 0;
+}
+
+static int profile_passes(network *net)
+{
+    return net->layer_time[net->n];
+}
+
+/* one row of the profile: ms per forward pass, FLOPs & bytes per image */
+typedef struct{
+    double ms, flops, bytes;
+} profile_row;
+
+static profile_row profile_layer_row(network *net, int i)
+{
+    profile_row r;
+    int frames = profile_passes(net) ? profile_passes(net) : 1;
+    r.ms = 1000*net->layer_time[i]/frames;
+    r.flops = profile_flops(net->layers[i]);
+    r.bytes = profile_bytes(net, i);
+    return r;
+}
+
+static double profile_total_ms(network *net)
+{
+    double t = 0;
+    int i;
+    for(i = 0; i < net->n; ++i) t += profile_layer_row(net, i).ms;
+    return t;
+}
+
+/* table of ms, share of time, GFLOPs, GFLOP/s, MB & GB/s per layer (per forward of batch size) */
+void print_network_profile(network *net, FILE *fp)
+{
+    int i;
+    if(!net->layer_time) return;
+    double total = profile_total_ms(net), flops = 0, bytes = 0;
+    fprintf(fp, "Profile of %d forward passes (batch %d)\n", profile_passes(net), net->batch);
+    fprintf(fp, "layer type              output       ms      %%    GFLOPs  GFLOP/s       MB     GB/s\n");
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        profile_row r = profile_layer_row(net, i);
+        flops += r.flops*l.batch;
+        bytes += r.bytes*l.batch;
+        fprintf(fp, "%5d %-13s %4d x%4d x%4d %8.3f %6.2f %9.3f %8.2f %8.2f %8.2f\n", i, get_layer_string(l.type),
+                l.out_w, l.out_h, l.out_c, r.ms, total > 0 ? 100*r.ms/total : 0, r.flops*l.batch/1e9,
+                r.ms > 0 ? r.flops*l.batch/r.ms/1e6 : 0, r.bytes*l.batch/1048576., r.ms > 0 ? r.bytes*l.batch/r.ms/1e6 : 0);
+    }
+    fprintf(fp, "total                                  %8.3f 100.00 %9.3f %8.2f %8.2f %8.2f\n", total, flops/1e9,
+            total > 0 ? flops/total/1e6 : 0, bytes/1048576., total > 0 ? bytes/total/1e6 : 0);
+}
+
+/* profile as .json (by extension) or csv - returns 0 if filename can not be written */
+int save_network_profile(network *net, char *filename)
+{
+    int i;
+    if(!net->layer_time) return 0;
+    FILE *fp = fopen(filename, "w");
+    if(!fp) return 0;
+    size_t len = strlen(filename);
+    int json = len > 5 && !strcmp(filename + len - 5, ".json");
+    double total = profile_total_ms(net);
+    if(json){
+        fprintf(fp, "{\n  \"forward_passes\": %d,\n  \"batch\": %d,\n  \"total_ms\": %f,\n  \"layers\": [\n",
+                profile_passes(net), net->batch, total);
+    } else {
+        fprintf(fp, "index,type,out_w,out_h,out_c,ms,percent,flops,bytes,gflops_per_s,gb_per_s\n");
+    }
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        profile_row r = profile_layer_row(net, i);
+        double flops = r.flops*l.batch, bytes = r.bytes*l.batch;
+        double gflops = r.ms > 0 ? flops/r.ms/1e6 : 0, gb = r.ms > 0 ? bytes/r.ms/1e6 : 0;
+        double percent = total > 0 ? 100*r.ms/total : 0;
+        if(json){
+            fprintf(fp, "    {\"index\": %d, \"type\": \"%s\", \"out_w\": %d, \"out_h\": %d, \"out_c\": %d, \"ms\": %f, "
+                    "\"percent\": %f, \"flops\": %.0f, \"bytes\": %.0f, \"gflops_per_s\": %f, \"gb_per_s\": %f}%s\n",
+                    i, get_layer_string(l.type), l.out_w, l.out_h, l.out_c, r.ms, percent, flops, bytes, gflops, gb,
+                    i + 1 < net->n ? "," : "");
+        } else {
+            fprintf(fp, "%d,%s,%d,%d,%d,%f,%f,%.0f,%.0f,%f,%f\n", i, get_layer_string(l.type), l.out_w, l.out_h,
+                    l.out_c, r.ms, percent, flops, bytes, gflops, gb);
+        }
+    }
+    if(json) fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    return 1;
+}
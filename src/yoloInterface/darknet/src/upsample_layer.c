@@ -1,10 +1,11 @@
 #include "upsample_layer.h"
 #include "cuda.h"
 #include "blas.h"
+#include "blocked_layout.h"
 
 #include <stdio.h>
 
-layer make_upsample_layer(int batch, int w, int h, int c, int stride)
+layer make_upsample_layer(int batch, int w, int h, int c, int stride, int train)
 {
     layer l = {0};
     l.type = UPSAMPLE;
@@ -24,7 +25,7 @@ layer make_upsample_layer(int batch, int w, int h, int c, int stride)
     l.stride = stride;
     l.outputs = l.out_w*l.out_h*l.out_c;
     l.inputs = l.w*l.h*l.c;
-    l.delta =  calloc(l.outputs*batch, sizeof(float));
+    if(train) l.delta =  calloc(l.outputs*batch, sizeof(float));
     l.output = calloc(l.outputs*batch, sizeof(float));;
 
     l.forward = forward_upsample_layer;
@@ -53,7 +54,7 @@ void resize_upsample_layer(layer *l, int w, int h)
     }
     l->outputs = l->out_w*l->out_h*l->out_c;
     l->inputs = l->h*l->w*l->c;
-    l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
+    if(l->delta) l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
     l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
@@ -65,10 +66,36 @@ void resize_upsample_layer(layer *l, int w, int h)
     
 }
 
+/* NCHW16c input & output (blocked_layout.c): every output pixel is a copy of one input pixel vector */
+static void forward_upsample_layer_blocked(const layer l, network net)
+{
+    int b, cb, y, x, k;
+    const int blocks = l.c/BLOCKED_C;
+    for(b = 0; b < l.batch; ++b){
+        for(cb = 0; cb < blocks; ++cb){
+            const float *in = net.input + ((size_t)b*blocks + cb)*l.h*l.w*BLOCKED_C;
+            float *out = l.output + ((size_t)b*blocks + cb)*l.out_h*l.out_w*BLOCKED_C;
+            for(y = 0; y < l.out_h; ++y){
+                const float *row = in + (size_t)(y/l.stride)*l.w*BLOCKED_C;
+                for(x = 0; x < l.out_w; ++x){
+                    const float *v = row + (x/l.stride)*BLOCKED_C;
+                    for(k = 0; k < BLOCKED_C; ++k) out[k] = l.scale*v[k];
+                    out += BLOCKED_C;
+                }
+            }
+        }
+    }
+}
+
 void forward_upsample_layer(const layer l, network net)
 {
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    if(l.view_only) return;
+    if(l.blocked){
+        forward_upsample_layer_blocked(l, net);
+        return;
+    }
     if(l.reverse){
+        fill_cpu(l.outputs*l.batch, 0, l.output, 1);
         upsample_cpu(l.output, l.out_w, l.out_h, l.c, l.batch, l.stride, 0, l.scale, net.input);
     }else{
         upsample_cpu(net.input, l.w, l.h, l.c, l.batch, l.stride, 1, l.scale, l.output);
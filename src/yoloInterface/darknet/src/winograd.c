@@ -0,0 +1,355 @@
+#include "winograd.h"
+#include "convolutional_layer.h"
+#include "gemm.h"
+#include "blas.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Winograd F(m,3) convolution for 3x3 stride 1 layers (Lavin & Gray):
+   output is cut into m x m tiles, each computed from an alpha x alpha (alpha = m+2) input patch as
+   Y = AT [ (G g GT) * (BT d B) ] A, where the elementwise product summed over input channels becomes
+   alpha*alpha independent gemms (filters x channels) * (channels x tiles).
+   F(4,3) needs 36 multiplies per 16 outputs instead of 144, F(2,3) 16 per 4 instead of 36.
+   G g GT is done once when weights are loaded and stored packed for gemm_packed_a, since with few tiles per
+   gemm packing the weights would cost more than the multiplies. Tile transforms run on WINOGRAD_LANES tiles
+   at once, laid out so the innermost loop goes over tiles (one simd lane each), with BT & AT written out
+   so only their non zero coefficients cost anything. */
+
+#define WINOGRAD_MAX_ALPHA 6
+#define WINOGRAD_LANES 16
+#define WINOGRAD_TILE_BLOCK 256 /* tiles per round of gemms - bounds workspace */
+#define WINOGRAD_TOLERANCE 1e-4 /* max |winograd - im2col| / max |im2col| accepted by benchmark_winograd_network */
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define WINOGRAD_SIMD __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define WINOGRAD_SIMD
+#endif
+
+/* input transform BT & output transform AT are hard coded in winograd_bt / winograd_at */
+typedef struct{
+    int m;
+    int alpha;
+    float G[WINOGRAD_MAX_ALPHA][3];
+} winograd_transform;
+
+static const winograd_transform winograd_f23 = {2, 4,
+    {{1, 0, 0}, {.5, .5, .5}, {.5, -.5, .5}, {0, 0, 1}}};
+
+static const winograd_transform winograd_f43 = {4, 6,
+    {{1/4., 0, 0}, {-1/6., -1/6., -1/6.}, {-1/6., 1/6., -1/6.}, {1/24., 1/12., 1/6.}, {1/24., -1/12., 1/6.}, {0, 0, 1}}};
+
+static const winograd_transform *get_winograd_transform(int tile)
+{
+    return tile == 2 ? &winograd_f23 : &winograd_f43;
+}
+
+static int winograd_tiles(layer l, int m, int *tiles_x)
+{
+    *tiles_x = (l.out_w + m - 1)/m;
+    return *tiles_x * ((l.out_h + m - 1)/m);
+}
+
+/* tile = 2 or 4 selects F(2,3) / F(4,3), anything else keeps im2col. ignored for layers winograd can not run */
+void setup_winograd_convolution(layer *l, int tile)
+{
+    if(tile != 2 && tile != 4) return;
+    if(l->size != 3 || l->stride != 1 || l->groups != 1 || l->binary || l->xnor) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    l->winograd_tile = tile;
+    l->winograd_weights = calloc(get_winograd_weights_size(*l), sizeof(float));
+    transform_winograd_weights(*l);
+    size_t s = get_winograd_workspace_size(*l);
+    if(s > l->workspace_size) l->workspace_size = s;
+}
+
+/* floats in winograd_weights */
+size_t get_winograd_weights_size(layer l)
+{
+    const winograd_transform *t = get_winograd_transform(l.winograd_tile);
+    return t->alpha*t->alpha*gemm_packed_a_size(l.n, l.c);
+}
+
+/* U = G g GT for every (filter, channel), packed per xi - must run again whenever l.weights change */
+void transform_winograd_weights(layer l)
+{
+    if(!l.winograd_tile) return;
+    const winograd_transform *t = get_winograd_transform(l.winograd_tile);
+    const int a = t->alpha;
+    const int K = l.n;
+    const int C = l.c;
+    float *U = calloc((size_t)a*a*K*C, sizeof(float));
+    int k, xi;
+    #pragma omp parallel for
+    for(k = 0; k < K; ++k){
+        int c, i, j, r;
+        for(c = 0; c < C; ++c){
+            const float *g = l.weights + (k*C + c)*9;
+            float tmp[WINOGRAD_MAX_ALPHA][3];
+            for(i = 0; i < a; ++i){
+                for(j = 0; j < 3; ++j){
+                    float sum = 0;
+                    for(r = 0; r < 3; ++r) sum += t->G[i][r]*g[r*3 + j];
+                    tmp[i][j] = sum;
+                }
+            }
+            for(i = 0; i < a; ++i){
+                for(j = 0; j < a; ++j){
+                    float sum = 0;
+                    for(r = 0; r < 3; ++r) sum += tmp[i][r]*t->G[j][r];
+                    U[((size_t)(i*a + j)*K + k)*C + c] = sum;
+                }
+            }
+        }
+    }
+    for(xi = 0; xi < a*a; ++xi){
+        gemm_pack_a(0, K, C, U + (size_t)xi*K*C, C, l.winograd_weights + xi*gemm_packed_a_size(K, C));
+    }
+    free(U);
+}
+
+size_t get_winograd_workspace_size(layer l)
+{
+    if(!l.winograd_tile) return 0;
+    const winograd_transform *t = get_winograd_transform(l.winograd_tile);
+    int tiles_x;
+    int tiles = winograd_tiles(l, t->m, &tiles_x);
+    if(tiles > WINOGRAD_TILE_BLOCK) tiles = WINOGRAD_TILE_BLOCK;
+    return (size_t)t->alpha*t->alpha*(l.c + l.n)*tiles*sizeof(float);
+}
+
+/* y = BT x for WINOGRAD_LANES columns at once: x[i*sx + lane], y[i*sy + lane] */
+static inline __attribute__((always_inline)) void winograd_bt(int m, const float *restrict x, int sx, float *restrict y, int sy)
+{
+    int q;
+    if(m == 2){
+        for(q = 0; q < WINOGRAD_LANES; ++q){
+            float d0 = x[q], d1 = x[sx + q], d2 = x[2*sx + q], d3 = x[3*sx + q];
+            y[q] = d0 - d2;
+            y[sy + q] = d1 + d2;
+            y[2*sy + q] = d2 - d1;
+            y[3*sy + q] = d1 - d3;
+        }
+    } else {
+        for(q = 0; q < WINOGRAD_LANES; ++q){
+            float d0 = x[q], d1 = x[sx + q], d2 = x[2*sx + q], d3 = x[3*sx + q], d4 = x[4*sx + q], d5 = x[5*sx + q];
+            y[q] = 4*d0 - 5*d2 + d4;
+            y[sy + q] = d3 + d4 - 4*(d1 + d2);
+            y[2*sy + q] = 4*(d1 - d2) - d3 + d4;
+            y[3*sy + q] = 2*(d3 - d1) - d2 + d4;
+            y[4*sy + q] = 2*(d1 - d3) - d2 + d4;
+            y[5*sy + q] = 4*d1 - 5*d3 + d5;
+        }
+    }
+}
+
+/* y = AT x for WINOGRAD_LANES columns at once */
+static inline __attribute__((always_inline)) void winograd_at(int m, const float *restrict x, int sx, float *restrict y, int sy)
+{
+    int q;
+    if(m == 2){
+        for(q = 0; q < WINOGRAD_LANES; ++q){
+            float m0 = x[q], m1 = x[sx + q], m2 = x[2*sx + q], m3 = x[3*sx + q];
+            y[q] = m0 + m1 + m2;
+            y[sy + q] = m1 - m2 - m3;
+        }
+    } else {
+        for(q = 0; q < WINOGRAD_LANES; ++q){
+            float m0 = x[q], m1 = x[sx + q], m2 = x[2*sx + q], m3 = x[3*sx + q], m4 = x[4*sx + q], m5 = x[5*sx + q];
+            float s12 = m1 + m2, d12 = m1 - m2, s34 = m3 + m4, d34 = m3 - m4;
+            y[q] = m0 + s12 + s34;
+            y[sy + q] = d12 + 2*d34;
+            y[2*sy + q] = s12 + 4*s34;
+            y[3*sy + q] = d12 + 8*d34 + m5;
+        }
+    }
+}
+
+/* V[xi][c][tile] = (BT d B)[xi] of tiles [t0, t0+nt) of one channel */
+static inline __attribute__((always_inline)) void input_transform_channel(int m, const float *src,
+        int h, int w, int pad, int tiles_x, int t0, int nt, float *V, size_t xi_stride)
+{
+    const int a = m + 2;
+    const int row = WINOGRAD_MAX_ALPHA*WINOGRAD_LANES;
+    float d[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    float tmp[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    float v[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    int tt, i, j, q;
+    for(tt = 0; tt < nt; tt += WINOGRAD_LANES){
+        int lanes = nt - tt < WINOGRAD_LANES ? nt - tt : WINOGRAD_LANES;
+        for(q = 0; q < WINOGRAD_LANES; ++q){
+            int tile = t0 + tt + q;
+            int y0 = (tile / tiles_x)*m - pad;
+            int x0 = (tile % tiles_x)*m - pad;
+            if(q < lanes && y0 >= 0 && x0 >= 0 && y0 + a <= h && x0 + a <= w){
+                const float *p = src + y0*w + x0;
+                for(i = 0; i < a; ++i){
+                    for(j = 0; j < a; ++j) d[i][j][q] = p[i*w + j];
+                }
+            } else {
+                for(i = 0; i < a; ++i){
+                    int y = y0 + i;
+                    for(j = 0; j < a; ++j){
+                        int x = x0 + j;
+                        d[i][j][q] = (q < lanes && y >= 0 && y < h && x >= 0 && x < w) ? src[y*w + x] : 0;
+                    }
+                }
+            }
+        }
+        for(j = 0; j < a; ++j) winograd_bt(m, d[0][j], row, tmp[0][j], row);
+        for(i = 0; i < a; ++i) winograd_bt(m, tmp[i][0], WINOGRAD_LANES, v[i][0], WINOGRAD_LANES);
+        for(i = 0; i < a; ++i){
+            for(j = 0; j < a; ++j){
+                float *dst = V + (i*a + j)*xi_stride + tt;
+                for(q = 0; q < lanes; ++q) dst[q] = v[i][j][q];
+            }
+        }
+    }
+}
+
+/* output tiles [t0, t0+nt) of one filter from M[xi][tile]: Y = act(AT M A + bias), clipped to output size */
+static inline __attribute__((always_inline)) void output_transform_filter(int m, const float *M, size_t xi_stride,
+        int out_h, int out_w, int tiles_x, int t0, int nt, float bias, ACTIVATION act, float *dst)
+{
+    const int a = m + 2;
+    const int row = WINOGRAD_MAX_ALPHA*WINOGRAD_LANES;
+    float mv[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    float tmp[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    float y[WINOGRAD_MAX_ALPHA][WINOGRAD_MAX_ALPHA][WINOGRAD_LANES];
+    int tt, i, j, q;
+    for(tt = 0; tt < nt; tt += WINOGRAD_LANES){
+        int lanes = nt - tt < WINOGRAD_LANES ? nt - tt : WINOGRAD_LANES;
+        for(i = 0; i < a; ++i){
+            for(j = 0; j < a; ++j){
+                const float *src = M + (i*a + j)*xi_stride + tt;
+                for(q = 0; q < WINOGRAD_LANES; ++q) mv[i][j][q] = q < lanes ? src[q] : 0;
+            }
+        }
+        for(j = 0; j < a; ++j) winograd_at(m, mv[0][j], row, tmp[0][j], row);
+        for(i = 0; i < m; ++i) winograd_at(m, tmp[i][0], WINOGRAD_LANES, y[i][0], WINOGRAD_LANES);
+        for(q = 0; q < lanes; ++q){
+            int tile = t0 + tt + q;
+            int oy = (tile / tiles_x)*m;
+            int ox = (tile % tiles_x)*m;
+            float *p = dst + oy*out_w + ox;
+            if(oy + m <= out_h && ox + m <= out_w){
+                for(i = 0; i < m; ++i){
+                    for(j = 0; j < m; ++j) p[i*out_w + j] = activate_inline(y[i][j][q] + bias, act);
+                }
+            } else {
+                for(i = 0; i < m && oy + i < out_h; ++i){
+                    for(j = 0; j < m && ox + j < out_w; ++j) p[i*out_w + j] = activate_inline(y[i][j][q] + bias, act);
+                }
+            }
+        }
+    }
+}
+
+typedef void (*input_transform_func)(const float *src, int h, int w, int pad, int tiles_x, int t0, int nt, float *V, size_t xi_stride);
+typedef void (*output_transform_func)(const float *M, size_t xi_stride, int out_h, int out_w, int tiles_x, int t0, int nt,
+        float bias, ACTIVATION act, float *dst);
+
+WINOGRAD_SIMD
+static void input_transform_f23(const float *src, int h, int w, int pad, int tiles_x, int t0, int nt, float *V, size_t xi_stride)
+{
+    input_transform_channel(2, src, h, w, pad, tiles_x, t0, nt, V, xi_stride);
+}
+
+WINOGRAD_SIMD
+static void input_transform_f43(const float *src, int h, int w, int pad, int tiles_x, int t0, int nt, float *V, size_t xi_stride)
+{
+    input_transform_channel(4, src, h, w, pad, tiles_x, t0, nt, V, xi_stride);
+}
+
+WINOGRAD_SIMD
+static void output_transform_f23(const float *M, size_t xi_stride, int out_h, int out_w, int tiles_x, int t0, int nt,
+        float bias, ACTIVATION act, float *dst)
+{
+    output_transform_filter(2, M, xi_stride, out_h, out_w, tiles_x, t0, nt, bias, act, dst);
+}
+
+WINOGRAD_SIMD
+static void output_transform_f43(const float *M, size_t xi_stride, int out_h, int out_w, int tiles_x, int t0, int nt,
+        float bias, ACTIVATION act, float *dst)
+{
+    output_transform_filter(4, M, xi_stride, out_h, out_w, tiles_x, t0, nt, bias, act, dst);
+}
+
+/* writes convolution of net.input to l.output - with bias & activation applied in the output transform
+   when the layer has no batchnorm, otherwise the raw convolution */
+void forward_winograd_convolution(layer l, network net)
+{
+    const winograd_transform *t = get_winograd_transform(l.winograd_tile);
+    const int a = t->alpha;
+    const int K = l.n;
+    const int C = l.c;
+    int tiles_x;
+    const int tiles = winograd_tiles(l, t->m, &tiles_x);
+    const int block = tiles < WINOGRAD_TILE_BLOCK ? tiles : WINOGRAD_TILE_BLOCK;
+    const size_t packed_size = gemm_packed_a_size(K, C);
+    input_transform_func input_transform = l.winograd_tile == 2 ? input_transform_f23 : input_transform_f43;
+    output_transform_func output_transform = l.winograd_tile == 2 ? output_transform_f23 : output_transform_f43;
+    float *V = net.workspace;
+    float *M = V + (size_t)a*a*C*block;
+    const int fused = !l.batch_normalize;
+    const ACTIVATION act = fused ? l.activation : LINEAR;
+    int b, t0;
+
+    for(b = 0; b < l.batch; ++b){
+        float *im = net.input + (size_t)b*l.inputs;
+        float *out = l.output + (size_t)b*l.outputs;
+        for(t0 = 0; t0 < tiles; t0 += block){
+            int nt = tiles - t0 < block ? tiles - t0 : block;
+            int c, k, xi;
+            #pragma omp parallel for
+            for(c = 0; c < C; ++c){
+                input_transform(im + (size_t)c*l.h*l.w, l.h, l.w, l.pad, tiles_x, t0, nt, V + (size_t)c*nt, (size_t)C*nt);
+            }
+            /* gemms are independent - one per thread (gemm itself stays serial inside) */
+            #pragma omp parallel for
+            for(xi = 0; xi < a*a; ++xi){
+                if(l.half_weights){
+                    gemm_packed_a_half(0, K, nt, C, (unsigned short *)l.winograd_weights + xi*packed_size, V + (size_t)xi*C*nt, nt, 0, M + (size_t)xi*K*nt, nt);
+                } else {
+                    gemm_packed_a(0, K, nt, C, l.winograd_weights + xi*packed_size, V + (size_t)xi*C*nt, nt, 0, M + (size_t)xi*K*nt, nt);
+                }
+            }
+            #pragma omp parallel for
+            for(k = 0; k < K; ++k){
+                output_transform(M + (size_t)k*nt, (size_t)K*nt, l.out_h, l.out_w, tiles_x, t0, nt,
+                        fused ? l.biases[k] : 0, act, out + (size_t)k*l.out_h*l.out_w);
+            }
+        }
+    }
+}
+
+/* times forward_convolutional_layer with im2col and with winograd on random input for every winograd layer
+   of net & checks outputs agree within WINOGRAD_TOLERANCE (relative to largest output) */
+void benchmark_winograd_network(network *net, int iterations)
+{
+    int i;
+    int failed = 0;
+    double total_old = 0, total_new = 0;
+    if(iterations < 1) iterations = 1;
+    printf("winograd benchmark, %d iteration(s) per layer, tolerance %g\n", iterations, WINOGRAD_TOLERANCE);
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL || !l.winograd_tile) continue;
+
+        layer im2col = l;
+        im2col.winograd_tile = 0;
+        conv_path_timing t = time_convolutional_paths(im2col, l, *net, 1, iterations);
+        int ok = t.error <= WINOGRAD_TOLERANCE;
+        failed += !ok;
+        total_old += t.ref_time;
+        total_new += t.time;
+        printf("layer %3d  %4d x%4d x%4d -> %4d  F(%d,3) | im2col %9.3f ms | winograd %9.3f ms (x%.2f) | error %.1e %s\n",
+                i, l.w, l.h, l.c, l.n, l.winograd_tile, t.ref_time*1000, t.time*1000, t.ref_time/t.time, t.error, ok ? "ok" : "FAILED");
+    }
+    printf("winograd layers total: im2col %.3f ms, winograd %.3f ms, %d layer(s) over tolerance\n", total_old*1000, total_new*1000, failed);
+}
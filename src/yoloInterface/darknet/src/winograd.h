@@ -0,0 +1,12 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "darknet.h"
+
+void setup_winograd_convolution(layer *l, int tile);
+void transform_winograd_weights(layer l);
+size_t get_winograd_weights_size(layer l);
+size_t get_winograd_workspace_size(layer l);
+void forward_winograd_convolution(layer l, network net);
+
+#endif
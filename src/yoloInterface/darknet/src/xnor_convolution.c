@@ -0,0 +1,434 @@
+#include "xnor_convolution.h"
+#include "convolutional_layer.h"
+#include "activations.h"
+#include "utils.h"
+#include "cpu_kernel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XNOR_X86
+#endif
+
+/* Bit-packed inference of xnor convolutions: the float path binarizes weights to +-mean|w| per filter and the input
+   to +-1, then runs a float gemm over them. here both are kept as sign bits (1 = positive), 64 per word, so the dot
+   product of a filter & an im2col column is valid - 2*popcount(w ^ x): valid positions minus twice the disagreeing
+   ones, times the filter's mean.
+   bits run over input channels: the input is binarized once into planes of words (64 channels each) and its im2col
+   only copies words - k is ordered [ky][kx][word] on both sides. columns are packed in panels of XNOR_NR (word k of
+   XNOR_NR columns contiguous), so the simd kernels count XNOR_NR columns per instruction and need no horizontal sums.
+   positions in the zero padding count for nothing in the float path: panels reaching into it carry a mask of the bits
+   inside the image and use popcount((w ^ x) & mask). unused bits (channel tail, row tail) are zero in weights and
+   input, so they always agree and never count. */
+
+#define XNOR_MR 4   /* filters per micro-kernel tile */
+#define XNOR_NR 16  /* columns per panel / micro-kernel tile */
+#define XNOR_NB 256 /* columns per parallel work item - multiple of XNOR_NR */
+
+typedef unsigned long long xnor_word;
+
+/* pop[r][j] = popcount((a_r ^ b_j) & m_j) over kw words - rows of a are kw words apart, b & m are panels, m = 0 for
+   panels without padding */
+typedef void (*xnor_micro_kernel)(int kw, const xnor_word *a, const xnor_word *b, const xnor_word *m,
+        int pop[XNOR_MR][XNOR_NR]);
+
+typedef struct{
+    cpu_kernel cpu;
+    xnor_micro_kernel kernel;
+} xnor_kernel_info;
+
+static inline __attribute__((always_inline)) void xnor_tile(int kw, const xnor_word *a, const xnor_word *b,
+        const xnor_word *m, int pop[XNOR_MR][XNOR_NR])
+{
+    int r, j, k;
+    for(r = 0; r < XNOR_MR; ++r){
+        for(j = 0; j < XNOR_NR; ++j) pop[r][j] = 0;
+    }
+    for(k = 0; k < kw; ++k){
+        const xnor_word *bk = b + (size_t)k*XNOR_NR;
+        for(r = 0; r < XNOR_MR; ++r){
+            const xnor_word ar = a[(size_t)r*kw + k];
+            if(m){
+                const xnor_word *mk = m + (size_t)k*XNOR_NR;
+                for(j = 0; j < XNOR_NR; ++j) pop[r][j] += __builtin_popcountll((ar ^ bk[j]) & mk[j]);
+            } else {
+                for(j = 0; j < XNOR_NR; ++j) pop[r][j] += __builtin_popcountll(ar ^ bk[j]);
+            }
+        }
+    }
+}
+
+/* portable kernel - popcount in software unless the compiler targets it */
+static void xnor_kernel_generic(int kw, const xnor_word *a, const xnor_word *b, const xnor_word *m,
+        int pop[XNOR_MR][XNOR_NR])
+{
+    xnor_tile(kw, a, b, m, pop);
+}
+
+#ifdef XNOR_X86
+
+/* the same loops with the popcnt instruction: 64 bits per instruction */
+__attribute__((target("popcnt")))
+static void xnor_kernel_popcnt(int kw, const xnor_word *a, const xnor_word *b, const xnor_word *m,
+        int pop[XNOR_MR][XNOR_NR])
+{
+    xnor_tile(kw, a, b, m, pop);
+}
+
+/* bytes of v counted with two 4 bit table lookups (vpshufb) */
+__attribute__((target("avx2")))
+static inline __m256i xnor_avx2_count_bytes(__m256i v, __m256i table, __m256i low)
+{
+    __m256i lo = _mm256_and_si256(v, low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(table, lo), _mm256_shuffle_epi8(table, hi));
+}
+
+/* 2 rows x XNOR_NR columns (4 ymm) - byte counts add up for at most 31 words (8 x 31 < 256), then vpsadbw sums the
+   8 bytes of each column's lane into its total */
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void xnor_avx2_rows(int kw, const xnor_word *a, const xnor_word *b,
+        const xnor_word *m, int pop[XNOR_MR][XNOR_NR], int r0)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    long long total[2][XNOR_NR] __attribute__((aligned(32)));
+    int r, v, k = 0;
+    memset(total, 0, sizeof(total));
+    while(k < kw){
+        const int end = kw - k > 31 ? k + 31 : kw;
+        __m256i acc[2][4];
+        for(r = 0; r < 2; ++r){
+            for(v = 0; v < 4; ++v) acc[r][v] = _mm256_setzero_si256();
+        }
+        for(; k < end; ++k){
+            __m256i ar[2];
+            for(r = 0; r < 2; ++r) ar[r] = _mm256_set1_epi64x(a[(size_t)(r0 + r)*kw + k]);
+            for(v = 0; v < 4; ++v){
+                __m256i bv = _mm256_loadu_si256((const __m256i *)(b + (size_t)k*XNOR_NR + 4*v));
+                __m256i mv = m ? _mm256_loadu_si256((const __m256i *)(m + (size_t)k*XNOR_NR + 4*v)) : _mm256_set1_epi8(-1);
+                for(r = 0; r < 2; ++r){
+                    __m256i x = _mm256_and_si256(_mm256_xor_si256(ar[r], bv), mv);
+                    acc[r][v] = _mm256_add_epi8(acc[r][v], xnor_avx2_count_bytes(x, table, low));
+                }
+            }
+        }
+        for(r = 0; r < 2; ++r){
+            for(v = 0; v < 4; ++v){
+                __m256i t = _mm256_load_si256((const __m256i *)(total[r] + 4*v));
+                t = _mm256_add_epi64(t, _mm256_sad_epu8(acc[r][v], _mm256_setzero_si256()));
+                _mm256_store_si256((__m256i *)(total[r] + 4*v), t);
+            }
+        }
+    }
+    for(r = 0; r < 2; ++r){
+        for(v = 0; v < XNOR_NR; ++v) pop[r0 + r][v] = total[r][v];
+    }
+}
+
+__attribute__((target("avx2")))
+static void xnor_kernel_avx2(int kw, const xnor_word *a, const xnor_word *b, const xnor_word *m,
+        int pop[XNOR_MR][XNOR_NR])
+{
+    xnor_avx2_rows(kw, a, b, m, pop, 0);
+    xnor_avx2_rows(kw, a, b, m, pop, 2);
+}
+
+/* vpopcntq: 8 columns per instruction, (a ^ b) & m in one vpternlogq */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static inline __attribute__((always_inline)) void xnor_vpopcnt_tile(int kw, const xnor_word *a, const xnor_word *b,
+        const xnor_word *m, int pop[XNOR_MR][XNOR_NR], int masked)
+{
+    __m512i acc[XNOR_MR][2];
+    int r, v, k;
+    for(r = 0; r < XNOR_MR; ++r){
+        for(v = 0; v < 2; ++v) acc[r][v] = _mm512_setzero_si512();
+    }
+    for(k = 0; k < kw; ++k){
+        __m512i bv[2], mv[2];
+        for(v = 0; v < 2; ++v){
+            bv[v] = _mm512_loadu_si512(b + (size_t)k*XNOR_NR + 8*v);
+            if(masked) mv[v] = _mm512_loadu_si512(m + (size_t)k*XNOR_NR + 8*v);
+        }
+        for(r = 0; r < XNOR_MR; ++r){
+            __m512i ar = _mm512_set1_epi64(a[(size_t)r*kw + k]);
+            for(v = 0; v < 2; ++v){
+                __m512i x = masked ? _mm512_ternarylogic_epi64(ar, bv[v], mv[v], 0x28) : _mm512_xor_si512(ar, bv[v]);
+                acc[r][v] = _mm512_add_epi64(acc[r][v], _mm512_popcnt_epi64(x));
+            }
+        }
+    }
+    for(r = 0; r < XNOR_MR; ++r){
+        for(v = 0; v < 2; ++v) _mm256_storeu_si256((__m256i *)(pop[r] + 8*v), _mm512_cvtepi64_epi32(acc[r][v]));
+    }
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void xnor_kernel_vpopcnt(int kw, const xnor_word *a, const xnor_word *b, const xnor_word *m,
+        int pop[XNOR_MR][XNOR_NR])
+{
+    if(m) xnor_vpopcnt_tile(kw, a, b, m, pop, 1);
+    else xnor_vpopcnt_tile(kw, a, b, m, pop, 0);
+}
+
+#endif
+
+static const xnor_kernel_info xnor_kernels[] = {
+#ifdef XNOR_X86
+    {{"vpopcnt", "avx512f avx512vpopcntdq"}, xnor_kernel_vpopcnt},
+    {{"avx2", "avx2"}, xnor_kernel_avx2},
+    {{"popcnt", "popcnt"}, xnor_kernel_popcnt},
+#endif
+    {{"generic", ""}, xnor_kernel_generic}
+};
+static cpu_kernel_table xnor_kernel_table = CPU_KERNEL_TABLE(xnor_kernels);
+
+static const xnor_kernel_info *get_xnor_kernel(void)
+{
+    return cpu_kernel_get(&xnor_kernel_table);
+}
+
+/* forces a kernel ("vpopcnt", "avx2", "popcnt", "generic") - returns 0 if not available on this cpu */
+int xnor_set_kernel(const char *name)
+{
+    return cpu_kernel_set(&xnor_kernel_table, name);
+}
+
+const char *xnor_kernel_name(void)
+{
+    return get_xnor_kernel()->cpu.name;
+}
+
+/* words per pixel of the binarized input */
+static int xnor_cw(layer l)
+{
+    return (l.c/l.groups + 63)/64;
+}
+
+/* words per filter / im2col column */
+static int xnor_kw(layer l)
+{
+    return l.size*l.size*xnor_cw(l);
+}
+
+/* filters per group, padded to whole tiles */
+static int xnor_mpad(layer l)
+{
+    return (l.n/l.groups + XNOR_MR - 1)/XNOR_MR*XNOR_MR;
+}
+
+static int xnor_npad(layer l)
+{
+    return (l.out_h*l.out_w + XNOR_NR - 1)/XNOR_NR*XNOR_NR;
+}
+
+/* bytes: binarized image, im2col panels & their masks, valid bits per column, padded flag per panel */
+size_t get_xnor_workspace_size(layer l)
+{
+    if(!l.xnor_weights) return 0;
+    size_t npad = xnor_npad(l);
+    return ((size_t)l.h*l.w*xnor_cw(l) + 2*npad*xnor_kw(l))*sizeof(xnor_word) + npad*sizeof(int) + npad/XNOR_NR;
+}
+
+/* cpu inference layers with xnor set get packed weights - forward_convolutional_layer uses them whenever not
+   training (training keeps binarizing the float weights, since they change). 1x1 layers with stride > 1 stay on the
+   float path: it reads 1x1 inputs without im2col, ignoring the stride, and the packed path does not match that */
+void setup_xnor_convolution(layer *l)
+{
+    if(!l->xnor) return;
+    if(l->size == 1 && l->stride != 1) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    l->xnor_weights = calloc((size_t)l->groups*xnor_mpad(*l)*xnor_kw(*l), sizeof(xnor_word));
+    l->xnor_scales = calloc((size_t)l->groups*xnor_mpad(*l), sizeof(float));
+    transform_xnor_weights(*l);
+    size_t s = get_xnor_workspace_size(*l);
+    if(s > l->workspace_size) l->workspace_size = s;
+}
+
+/* sign bits & mean |w| of every filter of l.weights (binarize_weights) - must run again whenever l.weights change */
+void transform_xnor_weights(layer l)
+{
+    if(!l.xnor_weights) return;
+    const int c = l.c/l.groups;
+    const int m = l.n/l.groups;
+    const int ss = l.size*l.size;
+    const int K = c*ss;
+    const int cw = xnor_cw(l), kw = xnor_kw(l), mpad = xnor_mpad(l);
+    int g, f, ci, j;
+    for(g = 0; g < l.groups; ++g){
+        for(f = 0; f < mpad; ++f){
+            xnor_word *row = l.xnor_weights + ((size_t)g*mpad + f)*kw;
+            memset(row, 0, kw*sizeof(xnor_word));
+            l.xnor_scales[g*mpad + f] = 0;
+            if(f >= m) continue;
+            const float *w = l.weights + ((size_t)g*m + f)*K;
+            float mean = 0;
+            for(j = 0; j < K; ++j) mean += fabs(w[j]);
+            l.xnor_scales[g*mpad + f] = mean/K;
+            for(ci = 0; ci < c; ++ci){
+                for(j = 0; j < ss; ++j){
+                    if(w[ci*ss + j] > 0) row[j*cw + ci/64] |= 1ULL << (ci%64);
+                }
+            }
+        }
+    }
+}
+
+/* c planes of h*w floats into cw planes of h*w words - bit ci%64 of plane ci/64 set where channel ci is positive */
+static void xnor_binarize(const float *in, int c, int h, int w, xnor_word *image)
+{
+    int y;
+    #pragma omp parallel for
+    for(y = 0; y < h; ++y){
+        int ci, x;
+        for(ci = 0; ci < c; ++ci){
+            const float *src = in + ((size_t)ci*h + y)*w;
+            xnor_word *dst = image + ((size_t)(ci/64)*h + y)*w;
+            const int bit = ci%64;
+            if(!bit) memset(dst, 0, w*sizeof(xnor_word));
+            for(x = 0; x < w; ++x) dst[x] |= (xnor_word)(src[x] > 0) << bit;
+        }
+    }
+}
+
+/* im2col of the binarized image in panels of XNOR_NR columns, their masks (all ones inside the image, zero in the
+   padding), the channel positions each column covers & per panel whether it reaches into padding */
+static void xnor_im2col(layer l, const xnor_word *image, xnor_word *cols, xnor_word *masks, int *valid,
+        unsigned char *padded)
+{
+    const int cw = xnor_cw(l), kw = xnor_kw(l), npad = xnor_npad(l);
+    const int n = l.out_h*l.out_w;
+    const int c = l.c/l.groups;
+    const size_t plane = (size_t)l.h*l.w;
+    int t;
+    #pragma omp parallel for
+    for(t = 0; t < npad/XNOR_NR; ++t){
+        xnor_word *panel = cols + (size_t)t*kw*XNOR_NR;
+        xnor_word *mask = masks + (size_t)t*kw*XNOR_NR;
+        int j, q, ky, kx, w;
+        padded[t] = 0;
+        for(q = 0; q < XNOR_NR; ++q){
+            j = t*XNOR_NR + q;
+            valid[j] = 0;
+            if(j >= n){
+                for(w = 0; w < kw; ++w) panel[w*XNOR_NR + q] = mask[w*XNOR_NR + q] = 0;
+                continue;
+            }
+            const int oy = j / l.out_w, ox = j % l.out_w;
+            for(ky = 0; ky < l.size; ++ky){
+                const int iy = oy*l.stride + ky - l.pad;
+                for(kx = 0; kx < l.size; ++kx){
+                    const int ix = ox*l.stride + kx - l.pad;
+                    const int seg = (ky*l.size + kx)*cw;
+                    const int inside = iy >= 0 && iy < l.h && ix >= 0 && ix < l.w;
+                    for(w = 0; w < cw; ++w){
+                        panel[(seg + w)*XNOR_NR + q] = inside ? image[w*plane + (size_t)iy*l.w + ix] : 0;
+                        mask[(seg + w)*XNOR_NR + q] = inside ? ~0ULL : 0;
+                    }
+                    if(inside) valid[j] += c;
+                    else padded[t] = 1;
+                }
+            }
+        }
+    }
+}
+
+/* slope of max(x, slope*x) that is activation a, or -1 when a has no such form */
+static float xnor_activation_slope(ACTIVATION a)
+{
+    if(a == LINEAR) return 1;
+    if(a == LEAKY) return .1;
+    if(a == RELU) return 0;
+    return -1;
+}
+
+/* out = scale*(valid - 2*popcount) of every filter & column, act(out + bias) if bias is given - leaky / relu /
+   linear in the store, other activations on each tile row right after it */
+static void xnor_gemm(layer l, const xnor_word *weights, const float *scales, const xnor_word *cols,
+        const xnor_word *masks, const int *valid, const unsigned char *padded, const float *bias, ACTIVATION act,
+        float *out)
+{
+    const xnor_micro_kernel kernel = get_xnor_kernel()->kernel;
+    const int kw = xnor_kw(l), mpad = xnor_mpad(l), npad = xnor_npad(l);
+    const int m = l.n/l.groups;
+    const int n = l.out_h*l.out_w;
+    const float slope = bias ? xnor_activation_slope(act) : 1;
+    int jb;
+    #pragma omp parallel for schedule(dynamic)
+    for(jb = 0; jb < npad; jb += XNOR_NB){
+        const int je = jb + XNOR_NB < npad ? jb + XNOR_NB : npad;
+        int pop[XNOR_MR][XNOR_NR];
+        float v[XNOR_NR];
+        int i, j, r, q;
+        for(i = 0; i < mpad; i += XNOR_MR){
+            for(j = jb; j < je; j += XNOR_NR){
+                const size_t panel = (size_t)j*kw;
+                kernel(kw, weights + (size_t)i*kw, cols + panel, padded[j/XNOR_NR] ? masks + panel : 0, pop);
+                const int nq = n - j < XNOR_NR ? n - j : XNOR_NR;
+                for(r = 0; r < XNOR_MR && i + r < m; ++r){
+                    const float scale = scales[i + r];
+                    const float b = bias ? bias[i + r] : 0;
+                    float *o = out + (size_t)(i + r)*n + j;
+                    for(q = 0; q < XNOR_NR; ++q){
+                        float x = scale*(valid[j + q] - 2*pop[r][q]) + b;
+                        v[q] = slope < 0 || x > slope*x ? x : slope*x;
+                    }
+                    memcpy(o, v, nq*sizeof(float));
+                    if(slope < 0) activate_array(o, nq, act);
+                }
+            }
+        }
+    }
+}
+
+/* output of an xnor layer from its packed weights - act(conv + bias) without batchnorm, the raw convolution with it */
+void forward_xnor_convolution(layer l, network net)
+{
+    const int m = l.n/l.groups;
+    const int c = l.c/l.groups;
+    const int npad = xnor_npad(l), kw = xnor_kw(l), mpad = xnor_mpad(l);
+    const int fused = !l.batch_normalize;
+    xnor_word *image = (xnor_word *)net.workspace;
+    xnor_word *cols = image + (size_t)l.h*l.w*xnor_cw(l);
+    xnor_word *masks = cols + (size_t)npad*kw;
+    int *valid = (int *)(masks + (size_t)npad*kw);
+    unsigned char *padded = (unsigned char *)(valid + npad);
+    int b, g;
+    for(b = 0; b < l.batch; ++b){
+        for(g = 0; g < l.groups; ++g){
+            xnor_binarize(net.input + ((size_t)b*l.c + g*c)*l.h*l.w, c, l.h, l.w, image);
+            xnor_im2col(l, image, cols, masks, valid, padded);
+            xnor_gemm(l, l.xnor_weights + (size_t)g*mpad*kw, l.xnor_scales + g*mpad, cols, masks, valid, padded,
+                    fused ? l.biases + g*m : 0, l.activation, l.output + ((size_t)b*l.n + g*m)*l.out_h*l.out_w);
+        }
+    }
+}
+
+/* times forward_convolutional_layer with the float xnor path (binarized float gemm) and the bit-packed one on random
+   input for every xnor layer of net & checks outputs agree */
+void benchmark_xnor_network(network *net, int iterations)
+{
+    int i;
+    double total_old = 0, total_new = 0;
+    if(iterations < 1) iterations = 1;
+    printf("xnor convolution benchmark, %d iteration(s) per layer, kernel: %s\n", iterations, xnor_kernel_name());
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != CONVOLUTIONAL || !l.xnor_weights) continue;
+
+        layer unpacked = l;
+        unpacked.xnor_weights = 0;
+        conv_path_timing t = time_convolutional_paths(unpacked, l, *net, 1, iterations);
+        total_old += t.ref_time;
+        total_new += t.time;
+        printf("layer %3d  %2dx%d/%d %4d x%4d x%4d -> %4d | float %9.3f ms | bits %9.3f ms (x%.2f) | error %.1e\n",
+                i, l.size, l.size, l.stride, l.w, l.h, l.c, l.n, t.ref_time*1000, t.time*1000, t.ref_time/t.time, t.error);
+    }
+    printf("xnor layers total: float %.3f ms, bits %.3f ms\n", total_old*1000, total_new*1000);
+}
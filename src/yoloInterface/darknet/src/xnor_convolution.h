@@ -0,0 +1,11 @@
+#ifndef XNOR_CONVOLUTION_H
+#define XNOR_CONVOLUTION_H
+
+#include "darknet.h"
+
+void setup_xnor_convolution(layer *l);
+void transform_xnor_weights(layer l);
+size_t get_xnor_workspace_size(layer l);
+void forward_xnor_convolution(layer l, network net);
+
+#endif
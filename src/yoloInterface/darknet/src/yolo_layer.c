@@ -9,8 +9,9 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes)
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int train)
 {
     int i;
     layer l = {0};
@@ -35,11 +36,11 @@ layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int
             l.mask[i] = i;
         }
     }
-    l.bias_updates = calloc(n*2, sizeof(float));
+    if(train) l.bias_updates = calloc(n*2, sizeof(float));
     l.outputs = h*w*n*(classes + 4 + 1);
     l.inputs = l.outputs;
     l.truths = 90*(4 + 1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if(train) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     for(i = 0; i < total*2; ++i){
         l.biases[i] = .5;
@@ -69,7 +70,7 @@ void resize_yolo_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -135,18 +136,20 @@ void forward_yolo_layer(const layer l, network net)
     memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
 
 #ifndef GPU
-    for (b = 0; b < l.batch; ++b){
-        for(n = 0; n < l.n; ++n){
-            int index = entry_index(l, b, n*l.w*l.h, 0);
-            activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
-            index = entry_index(l, b, n*l.w*l.h, 4);
-            activate_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
+    if(!net.yolo_raw || net.train){
+        for (b = 0; b < l.batch; ++b){
+            for(n = 0; n < l.n; ++n){
+                int index = entry_index(l, b, n*l.w*l.h, 0);
+                activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
+                index = entry_index(l, b, n*l.w*l.h, 4);
+                activate_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
+            }
         }
     }
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!net.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     float avg_iou = 0;
     float recall = 0;
     float recall75 = 0;
@@ -244,9 +247,8 @@ void backward_yolo_layer(const layer l, network net)
    axpy_cpu(l.batch*l.inputs, 1, l.delta, 1, net.delta, 1);
 }
 
-void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative)
+static box correct_yolo_box(box b, int w, int h, int netw, int neth, int relative)
 {
-    int i;
     int new_w=0;
     int new_h=0;
     if (((float)netw/w) < ((float)neth/h)) {
@@ -256,19 +258,24 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
         new_h = neth;
         new_w = (w * neth)/h;
     }
+    b.x =  (b.x - (netw - new_w)/2./netw) / ((float)new_w/netw); 
+    b.y =  (b.y - (neth - new_h)/2./neth) / ((float)new_h/neth); 
+    b.w *= (float)netw/new_w;
+    b.h *= (float)neth/new_h;
+    if(!relative){
+        b.x *= w;
+        b.w *= w;
+        b.y *= h;
+        b.h *= h;
+    }
+    return b;
+}
+
+void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative)
+{
+    int i;
     for (i = 0; i < n; ++i){
-        box b = dets[i].bbox;
-        b.x =  (b.x - (netw - new_w)/2./netw) / ((float)new_w/netw); 
-        b.y =  (b.y - (neth - new_h)/2./neth) / ((float)new_h/neth); 
-        b.w *= (float)netw/new_w;
-        b.h *= (float)neth/new_h;
-        if(!relative){
-            b.x *= w;
-            b.w *= w;
-            b.y *= h;
-            b.h *= h;
-        }
-        dets[i].bbox = b;
+        dets[i].bbox = correct_yolo_box(dets[i].bbox, w, h, netw, neth, relative);
     }
 }
 
@@ -342,13 +349,57 @@ int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh,
     return count;
 }
 
+/* Inference decode of raw (not activated, see network.yolo_raw) output of batch 0 - same boxes & probabilities as
+   get_yolo_detections, but objectness is rejected in logit space before any logistic is evaluated, box & class terms
+   are only computed for cells that pass and one yolo_candidate is written per (box, class) above thresh.
+   class_ids limits classes considered (all if null). returns number of candidates found - only first capacity are written */
+int decode_yolo_candidates(layer l, float *output, int w, int h, int netw, int neth, float thresh, int relative, const int *class_ids, int n_class_ids, yolo_candidate *cands, int capacity)
+{
+    int i, j, n;
+    int count = 0;
+    int stride = l.w*l.h;
+    int nclasses = class_ids ? n_class_ids : l.classes;
+    if(thresh >= 1) return 0;
+    /* logistic(x) > thresh <=> x > logit(thresh). small margin keeps rounding of logistic from dropping borderline cells - exact test follows */
+    float logit_thresh = (thresh > 0) ? log(thresh/(1 - thresh)) - .001 : -INFINITY;
+    for(n = 0; n < l.n; ++n){
+        float *x = output + n*stride*(4+l.classes+1);
+        float *obj = x + 4*stride;
+        for(i = 0; i < stride; ++i){
+            if(obj[i] <= logit_thresh) continue;
+            float objectness = logistic_activate(obj[i]);
+            if(objectness <= thresh) continue;
+
+            box b;
+            b.x = (i % l.w + logistic_activate(x[i])) / l.w;
+            b.y = (i / l.w + logistic_activate(x[i + stride])) / l.h;
+            b.w = exp(x[i + 2*stride]) * l.biases[2*l.mask[n]]   / netw;
+            b.h = exp(x[i + 3*stride]) * l.biases[2*l.mask[n]+1] / neth;
+            b = correct_yolo_box(b, w, h, netw, neth, relative);
+
+            for(j = 0; j < nclasses; ++j){
+                int class_id = class_ids ? class_ids[j] : j;
+                float prob = objectness*logistic_activate(x[i + (5 + class_id)*stride]);
+                if(prob <= thresh) continue;
+                if(count < capacity){
+                    cands[count].bbox = b;
+                    cands[count].prob = prob;
+                    cands[count].class_id = class_id;
+                }
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
 #ifdef GPU
 
 void forward_yolo_layer_gpu(const layer l, network net)
 {
     copy_gpu(l.batch*l.inputs, net.input_gpu, 1, l.output_gpu, 1);
     int b, n;
-    for (b = 0; b < l.batch; ++b){
+    for (b = 0; b < l.batch && (!net.yolo_raw || net.train); ++b){
         for(n = 0; n < l.n; ++n){
             int index = entry_index(l, b, n*l.w*l.h, 0);
             activate_array_gpu(l.output_gpu + index, 2*l.w*l.h, LOGISTIC);
@@ -5,7 +5,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes);
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int train);
 void forward_yolo_layer(const layer l, network net);
 void backward_yolo_layer(const layer l, network net);
 void resize_yolo_layer(layer *l, int w, int h);
@@ -0,0 +1,113 @@
+#include "nmsEngine.h"
+
+#include <algorithm>
+
+void NMSEngine::process(detection *dets, int total, int classes, float thresh) {
+    resetBuckets(classes);
+
+    //single pass over prob arrays - most entries are zero
+    for (int i = 0; i < total; ++i) {
+        if (dets[i].objectness == 0)
+            continue;
+        const float *prob = dets[i].prob;
+        for (int k = 0; k < classes; ++k) {
+            if (prob[k] != 0)
+                m_buckets[k].push_back(i);
+        }
+    }
+
+    m_last_candidates = 0;
+    for (int k = 0; k < classes; ++k) {
+        std::vector<int> &bucket = m_buckets[k];
+        m_last_candidates += bucket.size();
+        if (bucket.size() < 2)
+            continue;
+
+        suppressBucket(bucket, [dets, k](int i)->float {
+            return dets[i].prob[k];
+        }, [dets](int i)->const box & {
+            return dets[i].bbox;
+        }, thresh);
+        for (unsigned int i = 0; i < bucket.size(); ++i) {
+            if (m_suppressed[i])
+                dets[bucket[i]].prob[k] = 0;
+        }
+    }
+}
+
+void NMSEngine::process(yolo_candidate *cands, int total, int classes, float thresh) {
+    resetBuckets(classes);
+
+    for (int i = 0; i < total; ++i)
+        m_buckets[cands[i].class_id].push_back(i);
+
+    m_last_candidates = total;
+    for (int k = 0; k < classes; ++k) {
+        std::vector<int> &bucket = m_buckets[k];
+        if (bucket.size() < 2)
+            continue;
+
+        suppressBucket(bucket, [cands](int i)->float {
+            return cands[i].prob;
+        }, [cands](int i)->const box & {
+            return cands[i].bbox;
+        }, thresh);
+        for (unsigned int i = 0; i < bucket.size(); ++i) {
+            if (m_suppressed[i])
+                cands[bucket[i]].prob = 0;
+        }
+    }
+}
+
+unsigned int NMSEngine::getLastCandidates(void) const {
+    return m_last_candidates;
+}
+
+void NMSEngine::resetBuckets(int classes) {
+    if (int(m_buckets.size()) < classes)
+        m_buckets.resize(classes);
+    for (std::vector<int> &bucket : m_buckets)
+        bucket.clear(); //keeps capacity
+}
+
+template <typename SCORE, typename BOX>
+void NMSEngine::suppressBucket(std::vector<int> &bucket, SCORE score, BOX get_box, float thresh) {
+    std::sort(bucket.begin(), bucket.end(), [&score](int a, int b)->bool {
+        const float s_a = score(a), s_b = score(b);
+        return (s_a != s_b) ? s_a > s_b : a < b;
+    });
+
+    const int n = bucket.size();
+    m_left.resize(n);
+    m_top.resize(n);
+    m_right.resize(n);
+    m_bottom.resize(n);
+    m_area.resize(n);
+    m_suppressed.assign(n, 0);
+
+    //corners computed exactly like box_iou does, so results match do_nms_sort bit for bit
+    for (int i = 0; i < n; ++i) {
+        const box &b = get_box(bucket[i]);
+        m_left[i] = b.x - b.w / 2;
+        m_right[i] = b.x + b.w / 2;
+        m_top[i] = b.y - b.h / 2;
+        m_bottom[i] = b.y + b.h / 2;
+        m_area[i] = b.w * b.h;
+    }
+
+    const float *left = m_left.data(), *top = m_top.data(), *right = m_right.data(), *bottom = m_bottom.data(), *area = m_area.data();
+    unsigned char *suppressed = m_suppressed.data();
+    for (int i = 0; i < n; ++i) {
+        if (suppressed[i])
+            continue;
+
+        const float l = left[i], t = top[i], r = right[i], btm = bottom[i], a = area[i];
+        //branch free so compiler can vectorize
+        for (int j = i + 1; j < n; ++j) {
+            const float w = (r < right[j] ? r : right[j]) - (l > left[j] ? l : left[j]);
+            const float h = (btm < bottom[j] ? btm : bottom[j]) - (t > top[j] ? t : top[j]);
+            const float inter = (w < 0 || h < 0) ? 0.f : w * h;
+            suppressed[j] |= (inter / (a + area[j] - inter) > thresh);
+        }
+    }
+}
@@ -2,22 +2,46 @@
 
 #include "functions.h"
 
-YoloInterface::YoloInterface(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, float thresh)
+YoloInterface::YoloInterface(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, float thresh, bool half_weights, const std::string &conv_plan_file)
 : YoloInterface(thresh) {
-    loadNetwork(config_file, weights_file, class_labels_file); //load network 
+    loadNetwork(config_file, weights_file, class_labels_file, half_weights, conv_plan_file); //load network 
 }
 
-YoloInterface::YoloInterface(float thresh) : m_net(nullptr), m_net_size(0), m_thresh(thresh), m_thresh_hier(0.5) {
+YoloInterface::YoloInterface(float thresh) : m_net(nullptr), m_net_size(0), m_thresh(thresh), m_thresh_hier(0.5), m_raw_decode(false), m_pool() {
 }
 
 YoloInterface::~YoloInterface(void) {
     free_network(m_net);
+    free_detection_pool(&m_pool);
 }
 
-void YoloInterface::loadNetwork(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file) {
-    m_net = load_network(const_cast<char*> (config_file.c_str()), const_cast<char*> (weights_file.c_str()), 0);
-    m_net_size = m_net->n;
+void YoloInterface::loadNetwork(const std::string &config_file, const std::string &weights_file, const std::string &class_labels_file, bool half_weights, const std::string &conv_plan_file) {
+    //inference only: no training buffers are allocated & batchnorm is folded into convolution weights as they load
+    m_net = parse_network_cfg_custom(const_cast<char*> (config_file.c_str()), 1);
+    m_net->fold_batchnorm = 1;
+    if (half_weights)
+        m_net->half_weights = 1;
     set_batch_network(m_net, 1);
+    //algorithms are picked before weights load - they are transformed for the chosen one (& stored fp16) as they do
+    if (!conv_plan_file.empty())
+        tune_convolution_network(m_net, const_cast<char*> (config_file.c_str()), const_cast<char*> (conv_plan_file.c_str()));
+    if (!weights_file.empty())
+        load_weights(m_net, const_cast<char*> (weights_file.c_str()));
+    m_net_size = m_net->n;
+    //layer outputs share arena slots by lifetime (planned again whenever batch size changes)
+    plan_network_memory(m_net);
+
+    //yolo heads are decoded straight from raw outputs unless network has other (region/detection) output layers
+    m_raw_decode = false;
+    for (unsigned int i = 0; i < m_net_size; ++i) {
+        if (m_net->layers[i].type == YOLO)
+            m_raw_decode = true;
+        else if (m_net->layers[i].type == REGION || m_net->layers[i].type == DETECTION) {
+            m_raw_decode = false;
+            break;
+        }
+    }
+    m_net->yolo_raw = m_raw_decode;
 
     //get class names and convert to more usable format
     char **names = get_labels(const_cast<char*> (class_labels_file.c_str()));
@@ -32,41 +56,287 @@ void YoloInterface::setThresholds(float threshold, float threshold_hier) {
     m_thresh_hier = threshold_hier;
 }
 
+void YoloInterface::setClassWhitelist(const std::vector<std::string> &class_names) {
+    m_class_whitelist.clear();
+    for (const std::string &name : class_names) {
+        std::vector<std::string>::const_iterator it = std::find(m_class_names.begin(), m_class_names.end(), name);
+        if (it != m_class_names.end())
+            m_class_whitelist.push_back(it - m_class_names.begin());
+    }
+}
+
 std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > YoloInterface::processImage(const cv::Mat &img) {
-    image img_yolo = img_cv_to_yolo(img);
-    image img_resized = letterbox_image(img_yolo, m_net->w, m_net->h);
-    layer l = m_net->layers[m_net_size - 1];
+    CV_Assert(img.type() == CV_8UC3);
+    resize_batch_network(m_net, 1);
+
+    //normalized, channel swapped & letterboxed straight into network input
+    letterbox_bgr8_into(img.data, img.cols, img.rows, img.step, m_net->w, m_net->h, m_net->input);
 
     double time = what_time_is_it_now();
-    network_predict(m_net, img_resized.data);
+    network_predict(m_net, m_net->input);
     //printf("\nPredicted in %f seconds.\n", (what_time_is_it_now() - time));
 
-    int nboxes = 0;
-    detection *dets = get_network_boxes(m_net, img_yolo.w, img_yolo.h, m_thresh, m_thresh_hier, 0, 1, &nboxes);
+    getPredictions(0, img.cols, img.rows, m_predictions);
 
-    do_nms_sort(dets, nboxes, l.classes, 0.45);
+    return m_predictions;
+}
 
+void YoloInterface::processImage(const cv::Mat &img, std::vector<Detection> &detections) {
+    CV_Assert(img.type() == CV_8UC3);
+    resize_batch_network(m_net, 1);
 
-    m_predictions.clear();
-    m_predictions.reserve(nboxes);
+    letterbox_bgr8_into(img.data, img.cols, img.rows, img.step, m_net->w, m_net->h, m_net->input);
+    network_predict(m_net, m_net->input);
 
-    for (int i = 0; i < nboxes; ++i) {
-        cv::Point r_tl(img_yolo.w * (dets[i].bbox.x - dets[i].bbox.w / 2), img_yolo.h * (dets[i].bbox.y - dets[i].bbox.h / 2));
-        cv::Size r_scale(dets[i].bbox.w * img_yolo.w, dets[i].bbox.h * img_yolo.h);
+    getDetections(0, img.cols, img.rows, detections);
+}
 
-        for (unsigned int j = 0; j < m_class_names.size(); ++j) {
-            if (dets[i].prob[j] > m_thresh)
-                m_predictions.emplace_back(std::piecewise_construct, std::forward_as_tuple(r_tl, r_scale), std::forward_as_tuple(dets[i].prob[j], m_class_names[j]));
+const std::string& YoloInterface::getClassName(int class_id) const {
+    return m_class_names.at(class_id);
+}
+
+std::vector< std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > > YoloInterface::processImages(const std::vector<cv::Mat> &imgs) {
+    std::vector< std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > > predictions(imgs.size());
+    if (imgs.empty())
+        return predictions;
+
+    resize_batch_network(m_net, imgs.size());
+
+    //pack all frames contiguously into network input
+    for (unsigned int i = 0; i < imgs.size(); ++i) {
+        CV_Assert(imgs[i].type() == CV_8UC3);
+        letterbox_bgr8_into(imgs[i].data, imgs[i].cols, imgs[i].rows, imgs[i].step, m_net->w, m_net->h, m_net->input + i * m_net->inputs);
+    }
+
+    network_predict(m_net, m_net->input); //one forward pass for whole batch
+
+    for (unsigned int i = 0; i < imgs.size(); ++i)
+        getPredictions(i, imgs[i].cols, imgs[i].rows, predictions[i]);
+
+    return predictions;
+}
+
+void YoloInterface::benchmarkBatchSizes(const cv::Mat &img, unsigned int max_batch, unsigned int iterations) {
+    for (unsigned int batch = 1; batch <= max_batch; ++batch) {
+        const std::vector<cv::Mat> imgs(batch, img);
+        processImages(imgs); //warm up - includes reallocation for new batch size
+
+        double t1 = what_time_is_it_now();
+        for (unsigned int i = 0; i < iterations; ++i)
+            processImages(imgs);
+        double t2 = what_time_is_it_now();
+
+        std::cout << "Batch size " << batch << ": " << batch * iterations / (t2 - t1) << " images/sec" << std::endl;
+    }
+}
+
+void YoloInterface::compareGEMM(unsigned int iterations) {
+    benchmark_gemm_network(m_net, iterations);
+}
+
+void YoloInterface::compareWinograd(unsigned int iterations) {
+    benchmark_winograd_network(m_net, iterations);
+}
+
+void YoloInterface::compareDirect(unsigned int iterations) {
+    benchmark_direct_network(m_net, iterations);
+}
+
+void YoloInterface::calibrateInt8(const std::string &image_folder, const std::string &calibration_file) {
+    std::vector<cv::String> files;
+    cv::glob(image_folder, files);
+
+    //ranges must come from fp32 outputs of previous layers
+    m_net->int8 = 0;
+    m_net->int8_calibrate = 1;
+    std::vector<Detection> detections;
+    unsigned int count = 0;
+    for (const cv::String &file : files) {
+        const cv::Mat img = cv::imread(file);
+        if (img.empty())
+            continue;
+        processImage(img, detections);
+        ++count;
+    }
+    m_net->int8_calibrate = 0;
+
+    CV_Assert(count > 0);
+    save_int8_calibration(m_net, const_cast<char*> (calibration_file.c_str()));
+    std::cout << "Calibrated int8 ranges on " << count << " images -> " << calibration_file << std::endl;
+    enableInt8(calibration_file);
+}
+
+bool YoloInterface::enableInt8(const std::string &calibration_file) {
+    const int layers = load_int8_calibration(m_net, const_cast<char*> (calibration_file.c_str()));
+    if (layers <= 0) {
+        std::cerr << "Error: int8 calibration " << calibration_file << " does not match network!" << std::endl;
+        return false;
+    }
+    std::cout << "Int8 enabled for " << layers << " convolutions (" << int8_kernel_name() << " kernel)" << std::endl;
+    return true;
+}
+
+void YoloInterface::compareInt8(const std::string &image_folder, float iou_thresh) {
+    CV_Assert(m_net->int8);
+    std::vector<cv::String> files;
+    cv::glob(image_folder, files);
+
+    std::vector<Detection> dets_fp32, dets_int8;
+    unsigned int images = 0, count_fp32 = 0, count_int8 = 0, matched = 0;
+    double time_fp32 = 0, time_int8 = 0, sum_iou = 0, sum_score_diff = 0;
+    for (const cv::String &file : files) {
+        const cv::Mat img = cv::imread(file);
+        if (img.empty())
+            continue;
+
+        m_net->int8 = 0;
+        double t1 = what_time_is_it_now();
+        processImage(img, dets_fp32);
+        double t2 = what_time_is_it_now();
+        m_net->int8 = 1;
+        processImage(img, dets_int8);
+        double t3 = what_time_is_it_now();
+        time_fp32 += t2 - t1;
+        time_int8 += t3 - t2;
+
+        //greedy: every fp32 detection takes best unused int8 detection of same class
+        std::vector<bool> used(dets_int8.size(), false);
+        for (const Detection &d : dets_fp32) {
+            int best = -1;
+            float best_iou = iou_thresh;
+            for (unsigned int j = 0; j < dets_int8.size(); ++j) {
+                if (used[j] || dets_int8[j].class_id != d.class_id)
+                    continue;
+                const float iou = float((d.box & dets_int8[j].box).area()) / (d.box | dets_int8[j].box).area();
+                if (iou >= best_iou) {
+                    best_iou = iou;
+                    best = j;
+                }
+            }
+            if (best < 0)
+                continue;
+            used[best] = true;
+            ++matched;
+            sum_iou += best_iou;
+            sum_score_diff += std::abs(d.score - dets_int8[best].score);
         }
+        count_fp32 += dets_fp32.size();
+        count_int8 += dets_int8.size();
+        ++images;
     }
+    CV_Assert(images > 0);
+
+    std::cout << "Int8 (" << int8_kernel_name() << ") against fp32 on " << images << " images: " << count_fp32 << " fp32 & " << count_int8 << " int8 detections, " << matched << " matched (IoU >= " << iou_thresh << ")" << std::endl;
+    std::cout << "  recall " << (count_fp32 ? float(matched) / count_fp32 : 1.f) << ", precision " << (count_int8 ? float(matched) / count_int8 : 1.f)
+            << ", mean IoU " << (matched ? sum_iou / matched : 0.) << ", mean score difference " << (matched ? sum_score_diff / matched : 0.) << std::endl;
+    std::cout << "  fp32 " << 1000 * time_fp32 / images << "ms, int8 " << 1000 * time_int8 / images << "ms per image" << std::endl;
+}
 
-    free_detections(dets, nboxes);
-    free_image(img_resized);
-    free_image(img_yolo);
+void YoloInterface::compareInt8Layers(unsigned int iterations) {
+    benchmark_int8_network(m_net, iterations);
+}
 
-    sortPredictionsByObjectness();
+void YoloInterface::compareXnor(unsigned int iterations) {
+    benchmark_xnor_network(m_net, iterations);
+}
 
-    return m_predictions;
+void YoloInterface::enableProfiling(bool enable) {
+    profile_network(m_net, enable);
+}
+
+void YoloInterface::printProfile(const std::string &report_file) {
+    CV_Assert(m_net->layer_time);
+    print_network_profile(m_net, stdout);
+    if (!report_file.empty() && !save_network_profile(m_net, const_cast<char*> (report_file.c_str())))
+        std::cerr << "Error: could not write profile to " << report_file << std::endl;
+}
+
+void YoloInterface::profileLayers(const cv::Mat &img, unsigned int frames, const std::string &report_file) {
+    CV_Assert(frames > 0);
+    std::vector<Detection> detections;
+    processImage(img, detections); //warm up - first pass pays for page faults & packing buffers
+
+    enableProfiling();
+    for (unsigned int i = 0; i < frames; ++i)
+        processImage(img, detections);
+    printProfile(report_file);
+    enableProfiling(false);
+}
+
+void YoloInterface::comparePreprocessing(const cv::Mat &img, unsigned int iterations) {
+    CV_Assert(img.type() == CV_8UC3 && iterations > 0);
+    std::vector<float> fused(m_net->w * m_net->h * 3);
+    float max_diff = 0;
+
+    double t1 = what_time_is_it_now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        image img_yolo = img_cv_to_yolo(img);
+        image img_resized = letterbox_image(img_yolo, m_net->w, m_net->h);
+        if (i == 0) {
+            letterbox_bgr8_into(img.data, img.cols, img.rows, img.step, m_net->w, m_net->h, fused.data());
+            for (unsigned int j = 0; j < fused.size(); ++j)
+                max_diff = std::max(max_diff, std::abs(fused[j] - img_resized.data[j]));
+        }
+        free_image(img_resized);
+        free_image(img_yolo);
+    }
+    double t2 = what_time_is_it_now();
+    for (unsigned int i = 0; i < iterations; ++i)
+        letterbox_bgr8_into(img.data, img.cols, img.rows, img.step, m_net->w, m_net->h, fused.data());
+    double t3 = what_time_is_it_now();
+
+    const double old_ms = 1000 * (t2 - t1) / iterations, fused_ms = 1000 * (t3 - t2) / iterations;
+    std::cout << "Preprocessing " << img.cols << "x" << img.rows << " -> " << m_net->w << "x" << m_net->h << ": old " << old_ms << "ms, fused " << fused_ms << "ms, saved " << old_ms - fused_ms << "ms per frame (max difference: " << max_diff << ")" << std::endl;
+}
+
+void YoloInterface::compareNMS(const cv::Mat &img, unsigned int iterations) {
+    CV_Assert(img.type() == CV_8UC3 && iterations > 0);
+    resize_batch_network(m_net, 1);
+    letterbox_bgr8_into(img.data, img.cols, img.rows, img.step, m_net->w, m_net->h, m_net->input);
+    m_net->yolo_raw = 0; //get_network_boxes needs activated outputs
+    network_predict(m_net, m_net->input);
+    m_net->yolo_raw = m_raw_decode;
+
+    const int classes = m_class_names.size();
+    //surviving (box, class, prob) after nms - sorted so both results can be compared regardless of box order
+    auto getSurvivors = [classes](const detection *dets, int nboxes)->std::vector< std::vector<float> > {
+        std::vector< std::vector<float> > survivors;
+        for (int i = 0; i < nboxes; ++i)
+            for (int k = 0; k < classes; ++k)
+                if (dets[i].prob[k] != 0)
+                    survivors.push_back({dets[i].bbox.x, dets[i].bbox.y, dets[i].bbox.w, dets[i].bbox.h, float(k), dets[i].prob[k]});
+        std::sort(survivors.begin(), survivors.end());
+        return survivors;
+    };
+
+    NMSEngine nms;
+    for (float thresh : {0.5f, 0.001f}) {
+        int nboxes = 0;
+        double time_old = 0, time_new = 0;
+        std::vector< std::vector<float> > survivors_old, survivors_new;
+
+        for (unsigned int i = 0; i < iterations; ++i) {
+            detection *dets_old = get_network_boxes_batch(m_net, 0, img.cols, img.rows, thresh, m_thresh_hier, 0, 1, &nboxes);
+            detection *dets_new = get_network_boxes_batch(m_net, 0, img.cols, img.rows, thresh, m_thresh_hier, 0, 1, &nboxes);
+
+            double t1 = what_time_is_it_now();
+            do_nms_sort(dets_old, nboxes, classes, 0.45);
+            double t2 = what_time_is_it_now();
+            nms.process(dets_new, nboxes, classes, 0.45);
+            double t3 = what_time_is_it_now();
+            time_old += t2 - t1;
+            time_new += t3 - t2;
+
+            if (i == 0) {
+                survivors_old = getSurvivors(dets_old, nboxes);
+                survivors_new = getSurvivors(dets_new, nboxes);
+            }
+            free_detections(dets_old, nboxes);
+            free_detections(dets_new, nboxes);
+        }
+
+        std::cout << "NMS at threshold " << thresh << ": " << nboxes << " boxes, " << nms.getLastCandidates() << " class candidates | do_nms_sort " << 1000 * time_old / iterations << "ms, NMSEngine " << 1000 * time_new / iterations << "ms | results " << (survivors_old == survivors_new ? "identical" : "DIFFER") << std::endl;
+    }
 }
 
 void YoloInterface::saveResults(const std::string &filename) const {
@@ -182,8 +452,90 @@ image YoloInterface::img_cv_to_yolo(const cv::Mat &img) {
     return img_yolo;
 }
 
-void YoloInterface::sortPredictionsByObjectness(void) {
-    std::sort(m_predictions.begin(), m_predictions.end(), [](const std::pair<cv::Rect, std::pair<float, std::string>> &p1, const std::pair<cv::Rect, std::pair<float, std::string>> &p2)->bool {
-        return p1.second.first > p2.second.first;
+void YoloInterface::getPredictions(int batch, int img_w, int img_h, std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > &predictions) {
+    getDetections(batch, img_w, img_h, m_detections);
+    toPredictions(m_detections, predictions);
+}
+
+void YoloInterface::getDetections(int batch, int img_w, int img_h, std::vector<Detection> &detections) {
+    if (m_raw_decode) {
+        const unsigned int count = decodeCandidates(*m_net, batch, nullptr, img_w, img_h, m_candidates);
+        convertCandidates(m_candidates.data(), count, img_w, img_h, detections, m_nms);
+        return;
+    }
+
+    int nboxes = 0;
+    detection *dets = get_network_boxes_pool(m_net, batch, img_w, img_h, m_thresh, m_thresh_hier, 0, 1, &nboxes, &m_pool); //boxes stay owned by pool
+
+    convertDetections(dets, nboxes, img_w, img_h, detections, m_nms);
+}
+
+unsigned int YoloInterface::decodeCandidates(const network &net, int batch, float *saved, int img_w, int img_h, std::vector<yolo_candidate> &candidates) const {
+    const int *class_ids = m_class_whitelist.empty() ? nullptr : m_class_whitelist.data();
+    unsigned int count = 0;
+
+    for (int i = 0; i < net.n; ++i) {
+        const layer &l = net.layers[i];
+        if (l.type != YOLO)
+            continue;
+
+        float *output = saved ? saved : l.output + batch * l.outputs;
+        if (saved)
+            saved += l.outputs;
+
+        unsigned int found = decode_yolo_candidates(l, output, img_w, img_h, net.w, net.h, m_thresh, 1, class_ids, m_class_whitelist.size(), candidates.data() + count, candidates.size() - count);
+        if (count + found > candidates.size()) { //grow & decode layer again - stops once buffer fits busiest frame
+            candidates.resize(std::max<size_t>(2 * candidates.size(), count + found));
+            decode_yolo_candidates(l, output, img_w, img_h, net.w, net.h, m_thresh, 1, class_ids, m_class_whitelist.size(), candidates.data() + count, candidates.size() - count);
+        }
+        count += found;
+    }
+
+    return count;
+}
+
+void YoloInterface::convertCandidates(yolo_candidate *cands, unsigned int count, int img_w, int img_h, std::vector<Detection> &detections, NMSEngine &nms) const {
+    nms.process(cands, count, m_class_names.size(), 0.45);
+
+    detections.clear();
+    for (unsigned int i = 0; i < count; ++i) {
+        if (cands[i].prob != 0) //suppressed otherwise
+            detections.push_back(Detection{toRect(cands[i].bbox, img_w, img_h), cands[i].prob, cands[i].class_id});
+    }
+
+    sortDetections(detections);
+}
+
+void YoloInterface::convertDetections(detection *dets, int nboxes, int img_w, int img_h, std::vector<Detection> &detections, NMSEngine &nms) const {
+    nms.process(dets, nboxes, m_class_names.size(), 0.45);
+
+    detections.clear();
+
+    for (int i = 0; i < nboxes; ++i) {
+        const cv::Rect box = toRect(dets[i].bbox, img_w, img_h);
+
+        for (unsigned int j = 0; j < m_class_names.size(); ++j) {
+            if (dets[i].prob[j] > m_thresh && (m_class_whitelist.empty() || std::find(m_class_whitelist.begin(), m_class_whitelist.end(), int(j)) != m_class_whitelist.end()))
+                detections.push_back(Detection{box, dets[i].prob[j], int(j)});
+        }
+    }
+
+    sortDetections(detections);
+}
+
+cv::Rect YoloInterface::toRect(const box &b, int img_w, int img_h) {
+    return cv::Rect(cv::Point(img_w * (b.x - b.w / 2), img_h * (b.y - b.h / 2)), cv::Size(b.w * img_w, b.h * img_h));
+}
+
+void YoloInterface::sortDetections(std::vector<Detection> &detections) {
+    std::sort(detections.begin(), detections.end(), [](const Detection &d1, const Detection & d2)->bool {
+        return d1.score > d2.score;
     });
 }
+
+void YoloInterface::toPredictions(const std::vector<Detection> &detections, std::vector< std::pair<cv::Rect, std::pair<float, std::string>> > &predictions) const {
+    predictions.clear();
+    predictions.reserve(detections.size());
+    for (const Detection &d : detections)
+        predictions.emplace_back(std::piecewise_construct, std::forward_as_tuple(d.box), std::forward_as_tuple(d.score, m_class_names[d.class_id]));
+}
@@ -9,6 +9,20 @@ cv::Mat getPredictionImg(YoloInterface &y, const cv::Mat &img) {
     return YoloInterface::getPredictionsDisplayable(img, y.processImage(img));
 }
 
+//index of flag in argv (0 if absent) - flags can appear in any position and be combined
+int findFlag(int argc, char * argv[], const std::string &flag) {
+    for (int i = 1; i < argc; ++i)
+        if (flag == argv[i])
+            return i;
+    return 0;
+}
+
+//argument n positions after flag, or def if flag is absent or not followed by enough arguments
+std::string flagArg(int argc, char * argv[], const std::string &flag, int n = 1, const std::string &def = "") {
+    const int i = findFlag(argc, argv, flag);
+    return (i && i + n < argc) ? argv[i + n] : def;
+}
+
 int main(int argc, char * argv[]) {
     const std::string videoFile = "/home/dp/Downloads/20190125_181346.mp4";
 
@@ -16,11 +30,37 @@ int main(int argc, char * argv[]) {
     const std::string configFile = "/home/dp/Desktop/darknet-master/cfg/yolov3.cfg";
     const std::string weightsFile = "/home/dp/Desktop/darknet-master/weights/yolov3.weights";
 
-    YoloInterface yolo(configFile, weightsFile, labelFile);
+    const std::string convPlanFile = flagArg(argc, argv, "--conv-plan");
+    YoloInterface yolo(configFile, weightsFile, labelFile, 0.5, findFlag(argc, argv, "--half-weights"), convPlanFile);
 
     //const cv::Mat img = cv::imread("/home/dp/Desktop/trainSet/Stimuli/Indoor/001.jpg");
     //const cv::Mat img = cv::imread("/home/dp/Downloads/20181108_190017_HDR.jpg");
     const cv::Mat img = cv::imread("/home/dp/Downloads/IMG_0834.jpeg");
+    if (findFlag(argc, argv, "--benchmark-preprocess"))
+        yolo.comparePreprocessing(img);
+    if (findFlag(argc, argv, "--benchmark-nms"))
+        yolo.compareNMS(img);
+    if (findFlag(argc, argv, "--benchmark-batch"))
+        yolo.benchmarkBatchSizes(img);
+    if (findFlag(argc, argv, "--benchmark-gemm"))
+        yolo.compareGEMM();
+    if (findFlag(argc, argv, "--benchmark-winograd"))
+        yolo.compareWinograd();
+    if (findFlag(argc, argv, "--benchmark-direct"))
+        yolo.compareDirect();
+    if (findFlag(argc, argv, "--benchmark-xnor"))
+        yolo.compareXnor();
+    if (!flagArg(argc, argv, "--calibrate-int8", 2).empty())
+        yolo.calibrateInt8(flagArg(argc, argv, "--calibrate-int8", 1), flagArg(argc, argv, "--calibrate-int8", 2));
+    if (!flagArg(argc, argv, "--compare-int8", 2).empty() && yolo.enableInt8(flagArg(argc, argv, "--compare-int8", 2))) {
+        yolo.compareInt8(flagArg(argc, argv, "--compare-int8", 1));
+        yolo.compareInt8Layers();
+    }
+    if (findFlag(argc, argv, "--profile")) {
+        //optional output file - only if next argument is not another flag
+        const std::string profileFile = flagArg(argc, argv, "--profile");
+        yolo.profileLayers(img, 20, profileFile.compare(0, 2, "--") ? profileFile : "");
+    }
     DisplayImg(getPredictionImg(yolo, img), "full");
 
     int rStart = 100, cStart = 700;